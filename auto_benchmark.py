@@ -0,0 +1,17 @@
+import sys
+
+from misc.runner import BenchmarkRunner
+from misc.visualizer import ScalingVisualizer
+
+
+# Usage: python auto_benchmark.py [pool_benchmark arguments], e.g. --scale 0.1 --threads 1,2,4,8
+def main():
+    runner = BenchmarkRunner(arguments=sys.argv[1:])
+    runner.execute()
+
+    visualizer = ScalingVisualizer(rows=runner.get_results())
+    visualizer.generate_graphics()
+
+
+if __name__ == '__main__':
+    main()
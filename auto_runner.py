@@ -21,7 +21,7 @@ def main():
     runner.execute()
     avg_times, min_times = runner.get_results()
 
-    visualizer = Visualizer(avg_time=avg_times, min_time=min_times)
+    visualizer = Visualizer(avg_time=avg_times, min_time=min_times, programs=runner.get_programs())
     visualizer.generate_graphics()
 
 
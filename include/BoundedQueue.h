@@ -0,0 +1,224 @@
+#ifndef THREAD_POOLS_BOUNDED_QUEUE_H
+#define THREAD_POOLS_BOUNDED_QUEUE_H
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+
+#include "EventCount.h"
+
+// Bounded MPMC queue after Dmitry Vyukov. Every cell carries a sequence number
+// that says whose turn it is: a producer may fill cell (pos % capacity) when its
+// sequence equals pos, a consumer may empty it when it equals pos + 1. Producers
+// and consumers each claim positions with one CAS on their own padded counter
+// and never touch a lock. The capacity is rounded up to a power of two and fixed
+// for the lifetime of the queue.
+//
+// TryEnque() fails when the queue is full. Enque() blocks until there is room,
+// optionally only up to a timeout; the producers sleep on an EventCount that
+// TryDeque() signals.
+template<class T>
+class BoundedQueue
+{
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    struct alignas(64) PaddedPosition
+    {
+        std::atomic<std::size_t> value{0};
+    };
+
+public:
+    static constexpr std::size_t DefaultCapacity = 4096;
+
+    explicit BoundedQueue(std::size_t t_capacity = DefaultCapacity)
+            :
+            m_mask(RoundUpToPowerOfTwo(t_capacity < 2 ? 2 : t_capacity) - 1),
+            m_cells(new Cell[m_mask + 1])
+    {
+        for (std::size_t i = 0; i <= m_mask; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~BoundedQueue()
+    {
+        T val;
+        while (TryDeque(val))
+        {}
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+    BoundedQueue(BoundedQueue&&) = delete;
+    BoundedQueue& operator=(BoundedQueue&&) = delete;
+
+    // val is only moved from if the call succeeds.
+    bool TryEnque(T&& val)
+    {
+        std::size_t pos = m_enqueue_pos.value.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+            if (difference == 0)
+            {
+                if (m_enqueue_pos.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueue_pos.value.load(std::memory_order_relaxed);
+            }
+        }
+
+        ::new (&cell->storage) T(std::move(val));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Blocks while the queue is full.
+    void Enque(T&& val)
+    {
+        while (!TryEnque(std::move(val)))
+        {
+            const EventCount::Key key = m_not_full.PrepareWait();
+            if (TryEnque(std::move(val)))
+            {
+                m_not_full.CancelWait();
+                return;
+            }
+            m_not_full.Wait(key);
+        }
+    }
+
+    // Blocks while the queue is full, but at most for t_timeout. Returns false
+    // (and leaves val alone) if there still was no room by then.
+    template<typename Rep, typename Period>
+    bool Enque(T&& val, const std::chrono::duration<Rep, Period>& t_timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + t_timeout;
+        while (!TryEnque(std::move(val)))
+        {
+            const EventCount::Key key = m_not_full.PrepareWait();
+            if (TryEnque(std::move(val)))
+            {
+                m_not_full.CancelWait();
+                return true;
+            }
+            if (!m_not_full.WaitUntil(key, deadline))
+            {
+                return TryEnque(std::move(val));
+            }
+        }
+        return true;
+    }
+
+    // Items go in one by one, blocking whenever the queue is full.
+    template<typename Iterator>
+    void EnqueBulk(Iterator first, Iterator last)
+    {
+        for (; first != last; ++first)
+        {
+            Enque(std::move(*first));
+        }
+    }
+
+    // Moves in as much of the range as fits and returns where it stopped.
+    template<typename Iterator>
+    Iterator TryEnqueBulk(Iterator first, Iterator last)
+    {
+        for (; first != last; ++first)
+        {
+            if (!TryEnque(std::move(*first)))
+            {
+                break;
+            }
+        }
+        return first;
+    }
+
+    bool TryDeque(T& val)
+    {
+        std::size_t pos = m_dequeue_pos.value.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+            if (difference == 0)
+            {
+                if (m_dequeue_pos.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_dequeue_pos.value.load(std::memory_order_relaxed);
+            }
+        }
+
+        T* item = std::launder(reinterpret_cast<T*>(&cell->storage));
+        val = std::move(*item);
+        item->~T();
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        m_not_full.NotifyOne();
+        return true;
+    }
+
+    std::size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    // Approximate while other threads push or pop.
+    std::size_t Size() const
+    {
+        const std::size_t dequeued = m_dequeue_pos.value.load(std::memory_order_relaxed);
+        const std::size_t enqueued = m_enqueue_pos.value.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+private:
+    static std::size_t RoundUpToPowerOfTwo(std::size_t t_value)
+    {
+        std::size_t result = 1;
+        while (result < t_value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+private:
+    const std::size_t m_mask;
+    const std::unique_ptr<Cell[]> m_cells;
+    PaddedPosition m_enqueue_pos;
+    PaddedPosition m_dequeue_pos;
+    EventCount m_not_full;
+};
+
+#endif //THREAD_POOLS_BOUNDED_QUEUE_H
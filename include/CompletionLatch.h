@@ -0,0 +1,79 @@
+#ifndef THREAD_POOLS_COMPLETION_LATCH_H
+#define THREAD_POOLS_COMPLETION_LATCH_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <condition_variable>
+
+// Counts finished pieces of work. A pool worker that waits on it keeps running
+// pending tasks of the pool instead of blocking; any other thread just blocks.
+class CompletionLatch
+{
+public:
+    explicit CompletionLatch(std::size_t t_count)
+            :
+            m_remaining(t_count),
+            m_ready(t_count == 0)
+    {}
+
+    CompletionLatch(const CompletionLatch&) = delete;
+    CompletionLatch& operator=(const CompletionLatch&) = delete;
+    CompletionLatch(CompletionLatch&&) = delete;
+    CompletionLatch& operator=(CompletionLatch&&) = delete;
+
+    void CountDown()
+    {
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_ready.store(true, std::memory_order_release);
+            m_all_done.notify_all();
+        }
+    }
+
+    bool IsReady() const
+    {
+        return m_ready.load(std::memory_order_acquire);
+    }
+
+    template<typename ThreadPool>
+    void Wait(ThreadPool& t_pool)
+    {
+        if (t_pool.IsWorkerThread())
+        {
+            while (!IsReady())
+            {
+                if (!t_pool.RunPendingTask())
+                {
+                    std::this_thread::yield();
+                }
+            }
+            // CountDown() may still hold the mutex; the latch must outlive that.
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        else
+        {
+            Wait();
+        }
+    }
+
+    // Blocks; only for threads that are not workers of the pool doing the work.
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_all_done.wait(lock, [this]
+        {
+            return IsReady();
+        });
+    }
+
+private:
+    std::atomic<std::size_t> m_remaining;
+    std::atomic_bool m_ready;
+    std::condition_variable m_all_done;
+    std::mutex m_mutex;
+};
+
+#endif //THREAD_POOLS_COMPLETION_LATCH_H
@@ -0,0 +1,433 @@
+#ifndef THREAD_POOLS_CONCURRENT_LRU_CACHE_H
+#define THREAD_POOLS_CONCURRENT_LRU_CACHE_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "TaskFuture.h"
+
+// Limits of a ConcurrentLruCache. A limit of 0 means no limit, a ttl of 0 that
+// entries do not expire. Both limits are split evenly between the shards,
+// rounding down, so the cache never holds more than the limit. A small limit
+// gets fewer shards: each shard keeps room for a few entries.
+struct CacheOptions
+{
+    std::size_t maxEntries = 0;
+    std::size_t maxBytes = 0;
+    std::chrono::milliseconds ttl{0};
+    // 0 picks a few shards per hardware thread.
+    std::size_t shardCount = 0;
+};
+
+// Memoization cache in front of expensive tasks. Keys are spread over shards by
+// hash, each shard with its own shared_mutex, like the stripes of
+// ThreadSafeMap. Eviction is CLOCK, an approximation of LRU: a hit only sets the
+// entry's reference bit, so lookups take the shard lock shared and never write
+// anything but that bit. When a shard is over its limit, its hand sweeps the
+// entries, clearing reference bits and evicting the first entry that is
+// expired or was not used since the last sweep.
+//
+// The weigher tells what an entry costs against maxBytes; by default that is
+// sizeof(Key) + sizeof(Value). An expired entry is a miss and is removed by
+// the next write to its shard that needs room, or by Put().
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class ConcurrentLruCache
+{
+    typedef std::chrono::steady_clock clock;
+
+    struct Entry
+    {
+        Entry(Value t_value, clock::time_point t_expiresAt, std::size_t t_weight)
+                :
+                value(std::move(t_value)),
+                expiresAt(t_expiresAt),
+                weight(t_weight)
+        {}
+
+        Value value;
+        clock::time_point expiresAt;
+        std::size_t weight;
+        // Position in the shard's clock ring.
+        std::size_t slot = 0;
+        mutable std::atomic_bool referenced{false};
+    };
+
+    typedef std::unordered_map<Key, Entry, Hash, KeyEqual> index_type;
+    typedef typename index_type::value_type item_type;
+    typedef std::unordered_map<Key, std::vector<TaskPromise<Value>>, Hash, KeyEqual> pending_type;
+
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex mutex;
+        index_type index;
+        // The clock ring: every entry once, in no particular order.
+        std::vector<item_type*> ring;
+        std::size_t hand = 0;
+        std::size_t bytes = 0;
+        // Keys being computed by GetOrCompute(), with everyone waiting for them.
+        pending_type pending;
+    };
+
+    static constexpr std::size_t MinEntriesPerShard = 8;
+
+public:
+    typedef std::function<std::size_t(const Key&, const Value&)> weigher_type;
+
+    explicit ConcurrentLruCache(const CacheOptions& t_options = CacheOptions(), weigher_type t_weigher = nullptr,
+                                const Hash& t_hash = Hash(), const KeyEqual& t_equal = KeyEqual())
+            :
+            m_shardCount(ShardCountFor(t_options)),
+            m_shards(new Shard[m_shardCount]),
+            m_maxEntries(PerShard(t_options.maxEntries)),
+            m_maxBytes(PerShard(t_options.maxBytes)),
+            m_ttl(t_options.ttl),
+            m_weigher(std::move(t_weigher)),
+            m_hash(t_hash)
+    {
+        for (std::size_t i = 0; i < m_shardCount; ++i)
+        {
+            m_shards[i].index = index_type(0, t_hash, t_equal);
+            m_shards[i].pending = pending_type(0, t_hash, t_equal);
+        }
+    }
+
+    ConcurrentLruCache(const ConcurrentLruCache&) = delete;
+    ConcurrentLruCache& operator=(const ConcurrentLruCache&) = delete;
+    ConcurrentLruCache(ConcurrentLruCache&&) = delete;
+    ConcurrentLruCache& operator=(ConcurrentLruCache&&) = delete;
+
+    std::optional<Value> Get(const Key& t_key) const
+    {
+        const Shard& shard = ShardFor(m_hash(t_key));
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        if (const Entry* entry = FindLive(shard, t_key, clock::now()))
+        {
+            return entry->value;
+        }
+        return std::nullopt;
+    }
+
+    // Inserts or replaces the entry; it lives for the default ttl.
+    void Put(Key t_key, Value t_value)
+    {
+        Put(std::move(t_key), std::move(t_value), m_ttl);
+    }
+
+    template<typename Rep, typename Period>
+    void Put(Key t_key, Value t_value, const std::chrono::duration<Rep, Period>& t_ttl)
+    {
+        Shard& shard = ShardFor(m_hash(t_key));
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        Store(shard, std::move(t_key), std::move(t_value), ExpiryAfter(t_ttl));
+    }
+
+    bool Erase(const Key& t_key)
+    {
+        Shard& shard = ShardFor(m_hash(t_key));
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto found = shard.index.find(t_key);
+        if (found == shard.index.end())
+        {
+            return false;
+        }
+        Remove(shard, &*found);
+        return true;
+    }
+
+    // The cached value, or a future for t_function() run as a task on t_pool.
+    // Concurrent misses for the same key share that one task. The result is
+    // cached with the default ttl; if t_function throws, every waiter gets the
+    // exception and nothing is cached. The cache must outlive the task.
+    template<typename Pool, typename Function>
+    TaskFuture<Value> GetOrCompute(Pool& t_pool, const Key& t_key, Function t_function)
+    {
+        Shard& shard = ShardFor(m_hash(t_key));
+        TaskPromise<Value> promise;
+        TaskFuture<Value> result(promise.GetFuture());
+
+        std::optional<Value> cached = Get(t_key);
+        if (!cached)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (const Entry* entry = FindLive(shard, t_key, clock::now()))
+            {
+                cached.emplace(entry->value);
+            }
+            else
+            {
+                auto waiting = shard.pending.find(t_key);
+                if (waiting != shard.pending.end())
+                {
+                    waiting->second.push_back(std::move(promise));
+                    return result;
+                }
+                shard.pending[t_key].push_back(std::move(promise));
+            }
+        }
+        if (cached)
+        {
+            promise.SetValue(std::move(*cached));
+            return result;
+        }
+
+        t_pool.Post([this, &shard, key = t_key, function = std::move(t_function)]() mutable
+        {
+            Compute(shard, std::move(key), function);
+        });
+        return result;
+    }
+
+    // Sums the shards one after another, so under concurrent writes it is only
+    // a snapshot of each shard at a slightly different time. Expired entries
+    // that have not been removed yet are counted.
+    std::size_t Size() const
+    {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < m_shardCount; ++i)
+        {
+            std::shared_lock<std::shared_mutex> lock(m_shards[i].mutex);
+            size += m_shards[i].index.size();
+        }
+        return size;
+    }
+
+    std::size_t Bytes() const
+    {
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < m_shardCount; ++i)
+        {
+            std::shared_lock<std::shared_mutex> lock(m_shards[i].mutex);
+            bytes += m_shards[i].bytes;
+        }
+        return bytes;
+    }
+
+    std::size_t ShardCount() const
+    {
+        return m_shardCount;
+    }
+
+private:
+    // The low bits of the hash pick the bucket inside a shard, so the shard is
+    // picked by the high bits.
+    Shard& ShardFor(std::size_t t_hash) const
+    {
+        const std::size_t mixed = t_hash * 0x9E3779B97F4A7C15ull;
+        return m_shards[(mixed >> 32) & (m_shardCount - 1)];
+    }
+
+    // Caller holds the shard lock, shared is enough.
+    const Entry* FindLive(const Shard& t_shard, const Key& t_key, clock::time_point t_now) const
+    {
+        auto found = t_shard.index.find(t_key);
+        if (found == t_shard.index.end() || IsExpired(found->second, t_now))
+        {
+            return nullptr;
+        }
+        found->second.referenced.store(true, std::memory_order_relaxed);
+        return &found->second;
+    }
+
+    static bool IsExpired(const Entry& t_entry, clock::time_point t_now)
+    {
+        return t_entry.expiresAt <= t_now;
+    }
+
+    template<typename Rep, typename Period>
+    static clock::time_point ExpiryAfter(const std::chrono::duration<Rep, Period>& t_ttl)
+    {
+        if (t_ttl <= std::chrono::duration<Rep, Period>::zero())
+        {
+            return clock::time_point::max();
+        }
+        return clock::now() + std::chrono::duration_cast<clock::duration>(t_ttl);
+    }
+
+    std::size_t Weigh(const Key& t_key, const Value& t_value) const
+    {
+        return m_weigher ? m_weigher(t_key, t_value) : sizeof(Key) + sizeof(Value);
+    }
+
+    // Caller holds the shard lock exclusively.
+    void Store(Shard& t_shard, Key t_key, Value t_value, clock::time_point t_expiresAt)
+    {
+        const std::size_t weight = Weigh(t_key, t_value);
+        auto found = t_shard.index.find(t_key);
+        item_type* item;
+        if (found != t_shard.index.end())
+        {
+            item = &*found;
+            Entry& entry = item->second;
+            t_shard.bytes = t_shard.bytes - entry.weight + weight;
+            entry.value = std::move(t_value);
+            entry.expiresAt = t_expiresAt;
+            entry.weight = weight;
+        }
+        else
+        {
+            auto inserted = t_shard.index.emplace(std::piecewise_construct,
+                                                  std::forward_as_tuple(std::move(t_key)),
+                                                  std::forward_as_tuple(std::move(t_value), t_expiresAt, weight));
+            item = &*inserted.first;
+            item->second.slot = t_shard.ring.size();
+            t_shard.ring.push_back(item);
+            t_shard.bytes += weight;
+        }
+        MakeRoom(t_shard, item);
+    }
+
+    bool IsOver(const Shard& t_shard) const
+    {
+        return (m_maxEntries != 0 && t_shard.index.size() > m_maxEntries) ||
+               (m_maxBytes != 0 && t_shard.bytes > m_maxBytes);
+    }
+
+    // Sweeps the clock hand until the shard fits its limits again. t_keep, the
+    // entry just stored, goes last: only when it alone is over the limit.
+    void MakeRoom(Shard& t_shard, item_type* t_keep)
+    {
+        const clock::time_point now = clock::now();
+        while (IsOver(t_shard))
+        {
+            if (t_shard.ring.size() == 1)
+            {
+                Remove(t_shard, t_shard.ring.front());
+                return;
+            }
+            if (t_shard.hand >= t_shard.ring.size())
+            {
+                t_shard.hand = 0;
+            }
+            item_type* item = t_shard.ring[t_shard.hand];
+            if (item == t_keep)
+            {
+                ++t_shard.hand;
+                continue;
+            }
+            Entry& entry = item->second;
+            if (!IsExpired(entry, now) && entry.referenced.exchange(false, std::memory_order_relaxed))
+            {
+                ++t_shard.hand;
+                continue;
+            }
+            // The last entry moves into this slot; the hand looks at it next.
+            Remove(t_shard, item);
+        }
+    }
+
+    // Caller holds the shard lock exclusively.
+    static void Remove(Shard& t_shard, item_type* t_item)
+    {
+        const std::size_t slot = t_item->second.slot;
+        t_shard.ring[slot] = t_shard.ring.back();
+        t_shard.ring[slot]->second.slot = slot;
+        t_shard.ring.pop_back();
+        t_shard.bytes -= t_item->second.weight;
+        t_shard.index.erase(t_shard.index.find(t_item->first));
+    }
+
+    template<typename Function>
+    void Compute(Shard& t_shard, Key t_key, Function& t_function)
+    {
+        std::optional<Value> value;
+        std::exception_ptr error;
+        try
+        {
+            value.emplace(t_function());
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        std::vector<TaskPromise<Value>> waiters;
+        {
+            std::unique_lock<std::shared_mutex> lock(t_shard.mutex);
+            auto waiting = t_shard.pending.find(t_key);
+            waiters = std::move(waiting->second);
+            t_shard.pending.erase(waiting);
+            if (value)
+            {
+                Store(t_shard, std::move(t_key), *value, ExpiryAfter(m_ttl));
+            }
+        }
+        for (TaskPromise<Value>& waiter : waiters)
+        {
+            if (value)
+            {
+                waiter.SetValue(*value);
+            }
+            else
+            {
+                waiter.SetException(error);
+            }
+        }
+    }
+
+    // There are never more shards than the limit, so every share is at least 1.
+    std::size_t PerShard(std::size_t t_limit) const
+    {
+        return t_limit / m_shardCount;
+    }
+
+    // The requested (or default) count, halved until every shard gets at least
+    // MinEntriesPerShard of maxEntries and one byte of maxBytes.
+    static std::size_t ShardCountFor(const CacheOptions& t_options)
+    {
+        std::size_t limit = static_cast<std::size_t>(-1);
+        if (t_options.maxEntries != 0)
+        {
+            limit = std::max<std::size_t>(1, t_options.maxEntries / MinEntriesPerShard);
+        }
+        if (t_options.maxBytes != 0)
+        {
+            limit = std::min(limit, t_options.maxBytes);
+        }
+
+        std::size_t count = RoundUpToPowerOfTwo(t_options.shardCount != 0 ? t_options.shardCount : DefaultShardCount());
+        while (count > limit)
+        {
+            count >>= 1;
+        }
+        return count;
+    }
+
+    static std::size_t DefaultShardCount()
+    {
+        const std::size_t threads = std::thread::hardware_concurrency();
+        return std::max<std::size_t>(8, threads * 4);
+    }
+
+    static std::size_t RoundUpToPowerOfTwo(std::size_t t_value)
+    {
+        std::size_t result = 1;
+        while (result < t_value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+private:
+    const std::size_t m_shardCount;
+    std::unique_ptr<Shard[]> m_shards;
+    const std::size_t m_maxEntries;
+    const std::size_t m_maxBytes;
+    const std::chrono::milliseconds m_ttl;
+    const weigher_type m_weigher;
+    const Hash m_hash;
+};
+
+#endif //THREAD_POOLS_CONCURRENT_LRU_CACHE_H
@@ -0,0 +1,68 @@
+#ifndef THREAD_POOLS_COOPERATIVE_WAIT_H
+#define THREAD_POOLS_COOPERATIVE_WAIT_H
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "TaskFuture.h"
+
+// Waiting for a future from inside a task blocks the worker, and with recursive
+// divide and conquer every worker can end up waiting for a child that sits in a
+// queue nobody serves any more. A worker of t_pool therefore keeps running the
+// pool's pending tasks until the future is ready; other threads just block.
+template<typename T>
+bool IsFutureReady(const std::future<T>& t_future)
+{
+    return t_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+template<typename T>
+bool IsFutureReady(const std::shared_future<T>& t_future)
+{
+    return t_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+template<typename T>
+bool IsFutureReady(const TaskFuture<T>& t_future)
+{
+    return t_future.IsReady();
+}
+
+template<typename T>
+void BlockOnFuture(const std::future<T>& t_future)
+{
+    t_future.wait();
+}
+
+template<typename T>
+void BlockOnFuture(const std::shared_future<T>& t_future)
+{
+    t_future.wait();
+}
+
+template<typename T>
+void BlockOnFuture(const TaskFuture<T>& t_future)
+{
+    t_future.Wait();
+}
+
+template<typename ThreadPool, typename Future>
+void WaitForFuture(ThreadPool& t_pool, const Future& t_future)
+{
+    if (!t_pool.IsWorkerThread())
+    {
+        BlockOnFuture(t_future);
+        return;
+    }
+
+    while (!IsFutureReady(t_future))
+    {
+        if (!t_pool.RunPendingTask())
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+#endif //THREAD_POOLS_COOPERATIVE_WAIT_H
@@ -0,0 +1,368 @@
+#ifndef THREAD_POOLS_COROUTINE_H
+#define THREAD_POOLS_COROUTINE_H
+
+// Everything here needs C++20 coroutines; with C++17 the header is empty and
+// the pools have no Schedule().
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#define THREAD_POOLS_COROUTINES 1
+
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+#include <type_traits>
+
+#include "TaskFuture.h"
+
+// co_await pool.Schedule() suspends the coroutine and posts its resumption to
+// the pool. On a worker of the local-queue and work-stealing pools that puts
+// the coroutine on the worker's own queue, so the pool's Post() decides where
+// it runs. A coroutine posted to a pool that is destroyed before it runs is
+// never resumed.
+template<typename ThreadPool>
+class ScheduleOperation
+{
+public:
+    explicit ScheduleOperation(ThreadPool& t_pool)
+            :
+            m_pool(t_pool)
+    {}
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> t_handle)
+    {
+        m_pool.Post([t_handle]()
+        {
+            t_handle.resume();
+        });
+    }
+
+    void await_resume() const noexcept
+    {}
+
+private:
+    ThreadPool& m_pool;
+};
+
+template<typename T = void>
+class Task;
+
+namespace detail
+{
+    class PromiseBase
+    {
+        // Resumes whoever awaits the task, without growing the stack.
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> t_handle) const noexcept
+            {
+                std::coroutine_handle<> continuation = t_handle.promise().m_continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept
+            {}
+        };
+
+    public:
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        FinalAwaiter final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        void unhandled_exception() noexcept
+        {
+            m_exception = std::current_exception();
+        }
+
+        void SetContinuation(std::coroutine_handle<> t_continuation)
+        {
+            m_continuation = t_continuation;
+        }
+
+    protected:
+        void RethrowIfFailed()
+        {
+            if (m_exception)
+            {
+                std::rethrow_exception(m_exception);
+            }
+        }
+
+    private:
+        std::coroutine_handle<> m_continuation;
+        std::exception_ptr m_exception;
+    };
+
+    template<typename T>
+    class CoroutinePromise : public PromiseBase
+    {
+    public:
+        Task<T> get_return_object() noexcept;
+
+        template<typename U>
+        void return_value(U&& t_value)
+        {
+            m_value.emplace(std::forward<U>(t_value));
+        }
+
+        T TakeResult()
+        {
+            RethrowIfFailed();
+            return std::move(*m_value);
+        }
+
+    private:
+        std::optional<T> m_value;
+    };
+
+    template<>
+    class CoroutinePromise<void> : public PromiseBase
+    {
+    public:
+        Task<void> get_return_object() noexcept;
+
+        void return_void() noexcept
+        {}
+
+        void TakeResult()
+        {
+            RethrowIfFailed();
+        }
+    };
+
+    // A coroutine that starts at once and frees its own frame at the end.
+    struct DetachedCoroutine
+    {
+        struct promise_type
+        {
+            DetachedCoroutine get_return_object() noexcept
+            {
+                return {};
+            }
+
+            std::suspend_never initial_suspend() const noexcept
+            {
+                return {};
+            }
+
+            std::suspend_never final_suspend() const noexcept
+            {
+                return {};
+            }
+
+            void return_void() noexcept
+            {}
+
+            void unhandled_exception() noexcept
+            {
+                std::terminate();
+            }
+        };
+    };
+}
+
+// A lazily started coroutine with a result. It runs when it is awaited, on the
+// thread that awaits it, and the awaiting coroutine is suspended (no thread
+// blocks) until the task has finished; use co_await pool.Schedule() inside to
+// move to the pool, or Launch() to start a task from ordinary code.
+template<typename T>
+class Task
+{
+public:
+    typedef detail::CoroutinePromise<T> promise_type;
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Task(Task&& other) noexcept
+            :
+            m_handle(std::exchange(other.m_handle, nullptr))
+    {}
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task()
+    {
+        Reset();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        return Awaiter{m_handle};
+    }
+
+    auto operator co_await() & noexcept
+    {
+        return Awaiter{m_handle};
+    }
+
+private:
+    friend class detail::CoroutinePromise<T>;
+
+    struct Awaiter
+    {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() const noexcept
+        {
+            return handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> t_awaiting) noexcept
+        {
+            handle.promise().SetContinuation(t_awaiting);
+            return handle;
+        }
+
+        T await_resume()
+        {
+            return handle.promise().TakeResult();
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> t_handle)
+            :
+            m_handle(t_handle)
+    {}
+
+    void Reset()
+    {
+        if (m_handle)
+        {
+            std::exchange(m_handle, nullptr).destroy();
+        }
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail
+{
+    template<typename T>
+    Task<T> CoroutinePromise<T>::get_return_object() noexcept
+    {
+        return Task<T>(std::coroutine_handle<CoroutinePromise>::from_promise(*this));
+    }
+
+    inline Task<void> CoroutinePromise<void>::get_return_object() noexcept
+    {
+        return Task<void>(std::coroutine_handle<CoroutinePromise>::from_promise(*this));
+    }
+
+    template<typename ThreadPool, typename T>
+    DetachedCoroutine RunOn(ThreadPool& t_pool, Task<T> t_task, TaskPromise<T> t_promise)
+    {
+        co_await t_pool.Schedule();
+        std::exception_ptr failure;
+        if constexpr (std::is_void_v<T>)
+        {
+            try
+            {
+                co_await std::move(t_task);
+            }
+            catch (...)
+            {
+                failure = std::current_exception();
+            }
+            if (failure)
+            {
+                t_promise.SetException(failure);
+            }
+            else
+            {
+                t_promise.SetValue();
+            }
+        }
+        else
+        {
+            std::optional<T> value;
+            try
+            {
+                value.emplace(co_await std::move(t_task));
+            }
+            catch (...)
+            {
+                failure = std::current_exception();
+            }
+            if (failure)
+            {
+                t_promise.SetException(failure);
+            }
+            else
+            {
+                t_promise.SetValue(std::move(*value));
+            }
+        }
+    }
+}
+
+// Starts t_task on a worker of t_pool. The TaskFuture can be waited for from
+// ordinary code or awaited by another coroutine.
+template<typename ThreadPool, typename T>
+TaskFuture<T> Launch(ThreadPool& t_pool, Task<T> t_task)
+{
+    TaskPromise<T> promise;
+    TaskFuture<T> result(promise.GetFuture());
+    detail::RunOn(t_pool, std::move(t_task), std::move(promise));
+    return result;
+}
+
+// co_await on a TaskFuture suspends until the result is there; the coroutine
+// then goes on on the thread that provided the result.
+template<typename T>
+auto operator co_await(TaskFuture<T>&& t_future) noexcept
+{
+    struct Awaiter
+    {
+        TaskFuture<T> future;
+
+        bool await_ready() const noexcept
+        {
+            return future.IsReady();
+        }
+
+        void await_suspend(std::coroutine_handle<> t_handle)
+        {
+            future.OnReady([t_handle]()
+            {
+                t_handle.resume();
+            });
+        }
+
+        T await_resume()
+        {
+            return future.Get();
+        }
+    };
+    return Awaiter{std::move(t_future)};
+}
+
+#endif //defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#endif //THREAD_POOLS_COROUTINE_H
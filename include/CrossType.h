@@ -7,7 +7,9 @@
 #include "StaticThreadPoolWithLocalQueue.h"
 #elif defined(STEALING_THREAD_POOL)
 #include "StaticThreadPoolWithWorkStealing.h"
-#elif !defined(THREAD_POOL) && !defined(STEALING_THREAD_POOL) && !defined(QUEUE_THREAD_POOL)
+#elif defined(DYNAMIC_THREAD_POOL)
+#include "DynamicThreadPool.h"
+#else
 #ifdef _WIN32
 #include "StaticThreadPoolUsingWinApi.h"
 #elif __linux__
@@ -17,19 +19,37 @@
 #endif //_WIN32
 #endif //defined(THREAD_POOL)
 
+// Marks the pool names in benchmark output when the global queue is flat combining.
+#ifdef FLAT_COMBINING_GLOBAL_QUEUE
+#define CROSS_TYPE_QUEUE_SUFFIX " (flat combining)"
+#else
+#define CROSS_TYPE_QUEUE_SUFFIX ""
+#endif //FLAT_COMBINING_GLOBAL_QUEUE
+
 namespace cross_type
 {
-#if defined(THREAD_POOL)
+#if defined(THREAD_POOL) && defined(BOUNDED_GLOBAL_QUEUE)
+    typedef BoundedStaticThreadPool thread_pool;
+    constexpr const char* thread_pool_name = "bounded";
+#elif defined(THREAD_POOL)
     typedef StaticThreadPool thread_pool;
+    constexpr const char* thread_pool_name = "basic" CROSS_TYPE_QUEUE_SUFFIX;
 #elif defined(QUEUE_THREAD_POOL)
     typedef StaticThreadPoolWithLocalQueue thread_pool;
+    constexpr const char* thread_pool_name = "with local queue" CROSS_TYPE_QUEUE_SUFFIX;
 #elif defined(STEALING_THREAD_POOL)
     typedef StaticThreadPoolWithWorkingStealing thread_pool;
-#elif !defined(THREAD_POOL) && !defined(STEALING_THREAD_POOL) && !defined(QUEUE_THREAD_POOL)
+    constexpr const char* thread_pool_name = "with work stealing" CROSS_TYPE_QUEUE_SUFFIX;
+#elif defined(DYNAMIC_THREAD_POOL)
+    typedef DynamicThreadPool thread_pool;
+    constexpr const char* thread_pool_name = "dynamic" CROSS_TYPE_QUEUE_SUFFIX;
+#else
 #ifdef _WIN32
     typedef StaticThreadPoolUsingWinApi thread_pool;
+    constexpr const char* thread_pool_name = "using win api";
 #else
     typedef StaticThreadPoolUsingPosixApi thread_pool;
+    constexpr const char* thread_pool_name = "using posix api" CROSS_TYPE_QUEUE_SUFFIX;
 #endif //WIN32
 #endif //defined(THREAD_POOL)
 }
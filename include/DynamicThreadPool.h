@@ -0,0 +1,422 @@
+#ifndef THREAD_POOLS_DYNAMIC_THREAD_POOL_H
+#define THREAD_POOLS_DYNAMIC_THREAD_POOL_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+
+#include "JoinThreads.h"
+#include "FunctionWrapper.h"
+#include "GlobalQueue.h"
+#include "EventCount.h"
+#include "IdlePolicy.h"
+#include "ThreadPoolBase.h"
+#include "TimingWheel.h"
+#include "WorkerStats.h"
+
+// Bounds and thresholds of a DynamicThreadPool.
+//   minThreads       - workers that never retire (at least one)
+//   maxThreads       - the pool never has more workers than this
+//   maxQueueDelay    - a worker is added when tasks have waited this long and
+//                      none of them could be started
+//   blockedThreshold - a worker is added when more than this many workers are
+//                      inside a BlockingScope and none is idle
+//   idleTimeout      - a worker above minThreads retires after idling this long
+struct ElasticPolicy
+{
+    std::size_t minThreads = 1;
+    std::size_t maxThreads = 8 * std::max(1u, std::thread::hardware_concurrency());
+    std::chrono::microseconds maxQueueDelay{5000};
+    std::size_t blockedThreshold = 0;
+    std::chrono::milliseconds idleTimeout{5000};
+};
+
+// A pool that is not sized once in the constructor. It starts minThreads
+// workers, adds one for every submission that finds no idle worker until there
+// is one per CPU, and beyond that only when the queue stalls or workers block.
+// A supervisor thread looks at the queue every maxQueueDelay while there are
+// tasks waiting, and sleeps until the next submission while there are none.
+class DynamicThreadPool : public ThreadPoolBase<DynamicThreadPool>,
+                          public TimerScheduling<DynamicThreadPool>
+{
+public:
+    DynamicThreadPool(const DynamicThreadPool&) = delete;
+    DynamicThreadPool& operator=(const DynamicThreadPool&) = delete;
+    DynamicThreadPool(DynamicThreadPool&&) = delete;
+    DynamicThreadPool& operator=(DynamicThreadPool&&) = delete;
+
+    explicit DynamicThreadPool(const ElasticPolicy& t_policy = ElasticPolicy(),
+                               const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : m_policy(Sanitize(t_policy)), m_idlePolicy(t_idlePolicy),
+          m_cpuCount(std::max(1u, std::thread::hardware_concurrency())), m_joiner(m_threads)
+    {
+        try
+        {
+            while (Grow(m_policy.minThreads))
+            {}
+            m_supervisor = std::thread(&DynamicThreadPool::SupervisorThread, this);
+        }
+        catch (...)
+        {
+            Stop();
+            throw;
+        }
+    }
+
+    ~DynamicThreadPool()
+    {
+        Stop();
+    }
+
+    template<typename FunctionType>
+    std::future<typename std::result_of<FunctionType()>::type>
+    Submit(FunctionType function)
+    {
+        typedef typename std::result_of<FunctionType()>::type resultType;
+        std::packaged_task<resultType()> task(std::move(function));
+        std::future<resultType> result(task.get_future());
+        Post(std::move(task));
+        return result;
+    }
+
+    // Fire and forget: no future and no shared state.
+    template<typename FunctionType>
+    void Post(FunctionType function)
+    {
+        m_work_queue.Enque(FunctionWrapper(std::move(function)));
+        m_submitted.fetch_add(1, std::memory_order_seq_cst);
+        m_wakeup.NotifyOne();
+        WakeSupervisor();
+        GrowIfNoneIdle(1);
+    }
+
+    bool IsWorkerThread() const
+    {
+        return m_currentPool == this;
+    }
+
+    std::size_t ThreadCount() const
+    {
+        return m_threadCount.load(std::memory_order_relaxed);
+    }
+
+    // Per-worker counters and latency histograms, all zero unless the pool is
+    // built with THREAD_POOL_STATS. A retired worker's entry stays and is
+    // carried on by the next worker that starts.
+    PoolStats Stats() const
+    {
+        PoolStats stats;
+        {
+            std::lock_guard<std::mutex> lock(m_threadsMutex);
+            for (const WorkerStats& worker : m_stats)
+            {
+                stats.workers.push_back(worker.Snapshot());
+            }
+        }
+        stats.queuedTasks = m_work_queue.Size();
+        return stats;
+    }
+
+    // Wraps a stretch of a task that blocks (I/O, a lock, a future of another
+    // pool). While it lasts the worker does not count as available, so the pool
+    // may start another worker. Outside a worker of this pool it does nothing.
+    class BlockingScope
+    {
+    public:
+        explicit BlockingScope(DynamicThreadPool& t_pool)
+                :
+                m_pool(t_pool.IsWorkerThread() ? &t_pool : nullptr)
+        {
+            if (m_pool)
+            {
+                m_pool->EnterBlocking();
+            }
+        }
+
+        ~BlockingScope()
+        {
+            if (m_pool)
+            {
+                m_pool->m_blocked.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        BlockingScope(const BlockingScope&) = delete;
+        BlockingScope& operator=(const BlockingScope&) = delete;
+
+    private:
+        DynamicThreadPool* m_pool;
+    };
+
+private:
+    friend class ThreadPoolBase<DynamicThreadPool>;
+    friend class TimerScheduling<DynamicThreadPool>;
+
+    static ElasticPolicy Sanitize(ElasticPolicy t_policy)
+    {
+        t_policy.minThreads = std::max<std::size_t>(1, t_policy.minThreads);
+        t_policy.maxThreads = std::max(t_policy.minThreads, t_policy.maxThreads);
+        if (t_policy.maxQueueDelay <= std::chrono::microseconds::zero())
+        {
+            t_policy.maxQueueDelay = std::chrono::microseconds(1);
+        }
+        return t_policy;
+    }
+
+    void EnqueBatch(std::vector<FunctionWrapper>& t_tasks)
+    {
+        m_work_queue.EnqueBulk(t_tasks.begin(), t_tasks.end());
+        m_submitted.fetch_add(static_cast<std::int64_t>(t_tasks.size()), std::memory_order_seq_cst);
+        m_wakeup.NotifyMany(t_tasks.size());
+        WakeSupervisor();
+        GrowIfNoneIdle(t_tasks.size());
+    }
+
+    std::int64_t Pending() const
+    {
+        return m_submitted.load(std::memory_order_seq_cst) - m_started.load(std::memory_order_seq_cst);
+    }
+
+    // Called after m_submitted has gone up. Only the first submission after
+    // the supervisor parked takes its mutex; the seq_cst pair with
+    // SupervisorThread() makes sure that either it sees the new task or this
+    // sees it parked.
+    void WakeSupervisor()
+    {
+        if (m_supervisorParked.load(std::memory_order_seq_cst) &&
+            m_supervisorParked.exchange(false, std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> lock(m_supervisorMutex);
+            m_supervisorWakeup.notify_one();
+        }
+    }
+
+    // Up to one worker per CPU is added as soon as work finds nobody idle.
+    void GrowIfNoneIdle(std::size_t t_count)
+    {
+        const std::size_t limit = std::min(m_cpuCount, m_policy.maxThreads);
+        for (std::size_t i = 0; i < t_count && m_idle.load(std::memory_order_relaxed) == 0 &&
+                                m_threadCount.load(std::memory_order_relaxed) < limit; ++i)
+        {
+            if (!Grow(limit))
+            {
+                break;
+            }
+        }
+    }
+
+    void EnterBlocking()
+    {
+        const std::size_t blocked = m_blocked.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (blocked > m_policy.blockedThreshold && m_idle.load(std::memory_order_relaxed) == 0)
+        {
+            Grow(m_policy.maxThreads);
+        }
+    }
+
+    // Starts a worker unless the pool already has t_limit of them. The threads
+    // of retired workers are joined here, so m_threads does not keep growing.
+    bool Grow(std::size_t t_limit)
+    {
+        std::lock_guard<std::mutex> lock(m_threadsMutex);
+        if (m_done || m_threadCount.load(std::memory_order_relaxed) >= t_limit)
+        {
+            return false;
+        }
+
+        for (const std::thread::id& id : m_retired)
+        {
+            auto thread = std::find_if(m_threads.begin(), m_threads.end(), [&id](const std::thread& t_thread)
+            {
+                return t_thread.get_id() == id;
+            });
+            thread->join();
+            std::swap(*thread, m_threads.back());
+            m_threads.pop_back();
+        }
+        m_retired.clear();
+
+        WorkerStats* stats;
+        if (m_freeStats.empty())
+        {
+            stats = &m_stats.emplace_back();
+        }
+        else
+        {
+            stats = m_freeStats.back();
+            m_freeStats.pop_back();
+        }
+        m_threads.emplace_back(&DynamicThreadPool::WorkerThread, this, stats);
+        m_threadCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool TryRetire(WorkerStats* t_stats)
+    {
+        std::lock_guard<std::mutex> lock(m_threadsMutex);
+        if (m_done || m_threadCount.load(std::memory_order_relaxed) <= m_policy.minThreads || Pending() > 0)
+        {
+            return false;
+        }
+        m_threadCount.fetch_sub(1, std::memory_order_relaxed);
+        m_retired.push_back(std::this_thread::get_id());
+        m_freeStats.push_back(t_stats);
+        return true;
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_threadsMutex);
+            m_done = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_supervisorMutex);
+            m_supervisorWakeup.notify_all();
+        }
+        m_wakeup.NotifyAll();
+        if (m_supervisor.joinable())
+        {
+            m_supervisor.join();
+        }
+    }
+
+    // Like RunWorkerLoop(), but the worker keeps track of whether it is idle and
+    // parks only until its idle timeout, after which it may retire.
+    void WorkerThread(WorkerStats* t_stats)
+    {
+        m_currentPool = this;
+        IdleBackoff backoff(m_idlePolicy);
+        bool idle = false;
+        std::chrono::steady_clock::time_point idleSince;
+
+        while (!m_done)
+        {
+            FunctionWrapper task;
+            if (m_work_queue.TryDeque(task))
+            {
+                m_started.fetch_add(1, std::memory_order_seq_cst);
+                if (idle)
+                {
+                    idle = false;
+                    m_idle.fetch_sub(1, std::memory_order_relaxed);
+                }
+                t_stats->GlobalPop();
+                t_stats->Run(task);
+                backoff.Reset();
+                continue;
+            }
+
+            if (!idle)
+            {
+                idle = true;
+                m_idle.fetch_add(1, std::memory_order_relaxed);
+                idleSince = std::chrono::steady_clock::now();
+            }
+
+            if (backoff.Spin())
+            {
+                t_stats->Spin();
+                continue;
+            }
+
+            const EventCount::Key key = m_wakeup.PrepareWait();
+            if (m_done || Pending() > 0)
+            {
+                m_wakeup.CancelWait();
+            }
+            else
+            {
+                t_stats->Parking();
+                const bool woken = m_wakeup.WaitUntil(key, idleSince + m_policy.idleTimeout);
+                t_stats->Woken();
+                if (!woken)
+                {
+                    if (TryRetire(t_stats))
+                    {
+                        break;
+                    }
+                    idleSince = std::chrono::steady_clock::now();
+                }
+            }
+            backoff.Reset();
+        }
+
+        if (idle)
+        {
+            m_idle.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Adds a worker whenever tasks were waiting during a whole interval and not
+    // a single one of them was started, i.e. all workers are busy or blocked.
+    // With nothing pending it does not poll but sleeps until WakeSupervisor().
+    void SupervisorThread()
+    {
+        std::unique_lock<std::mutex> lock(m_supervisorMutex);
+        std::int64_t lastStarted = m_started.load(std::memory_order_relaxed);
+        while (!m_done)
+        {
+            if (Pending() == 0)
+            {
+                m_supervisorParked.store(true, std::memory_order_seq_cst);
+                m_supervisorWakeup.wait(lock, [this]
+                {
+                    return m_done.load() || Pending() > 0;
+                });
+                m_supervisorParked.store(false, std::memory_order_relaxed);
+                lastStarted = m_started.load(std::memory_order_relaxed);
+                continue;
+            }
+
+            if (m_supervisorWakeup.wait_for(lock, m_policy.maxQueueDelay, [this]
+            {
+                return m_done.load();
+            }))
+            {
+                break;
+            }
+
+            const std::int64_t started = m_started.load(std::memory_order_relaxed);
+            if (started == lastStarted && Pending() > 0 && m_idle.load(std::memory_order_relaxed) == 0)
+            {
+                Grow(m_policy.maxThreads);
+            }
+            lastStarted = started;
+        }
+    }
+
+private:
+    const ElasticPolicy m_policy;
+    const IdlePolicy m_idlePolicy;
+    const std::size_t m_cpuCount;
+    std::atomic_bool m_done{false};
+    EventCount m_wakeup;
+    DefaultGlobalQueue<FunctionWrapper> m_work_queue;
+    std::atomic<std::int64_t> m_submitted{0};
+    std::atomic<std::int64_t> m_started{0};
+    std::atomic<std::size_t> m_threadCount{0};
+    std::atomic<std::size_t> m_idle{0};
+    std::atomic<std::size_t> m_blocked{0};
+    mutable std::mutex m_threadsMutex;
+    std::vector<std::thread::id> m_retired;
+    std::deque<WorkerStats> m_stats;
+    std::vector<WorkerStats*> m_freeStats;
+    std::mutex m_supervisorMutex;
+    std::condition_variable m_supervisorWakeup;
+    std::atomic_bool m_supervisorParked{false};
+    std::thread m_supervisor;
+    TimingWheel m_timers{[this](FunctionWrapper&& t_task) { Post(std::move(t_task)); }};
+    std::vector<std::thread> m_threads;
+    JoinThreads m_joiner;
+    inline static thread_local DynamicThreadPool* m_currentPool = nullptr;
+};
+
+#endif //THREAD_POOLS_DYNAMIC_THREAD_POOL_H
@@ -0,0 +1,272 @@
+#ifndef THREAD_POOLS_EPOCH_RECLAMATION_H
+#define THREAD_POOLS_EPOCH_RECLAMATION_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+// Epoch-based reclamation. A reader pins the current epoch in its own padded
+// record for the duration of an EpochDomain::Guard; a writer unlinks an object
+// and Retire()s it, and the object is freed once the global epoch has moved two
+// steps past the retire, when no reader can still hold a pointer to it.
+// Readers only write their own record, so lookups do not bounce shared cache
+// lines between cores. Guards nest.
+class EpochDomain
+{
+    struct alignas(64) Record
+    {
+        // (epoch << 1) | 1 while the owner is inside a guard, 0 otherwise.
+        std::atomic<uint64_t> state{0};
+        std::atomic_bool inUse{true};
+        Record* next = nullptr;
+        unsigned depth = 0;
+    };
+
+    // Owned jointly by the domain and every thread that has a record in it, so a
+    // thread exiting after the domain is gone still has somewhere to write.
+    struct Registry
+    {
+        ~Registry()
+        {
+            Record* record = head.load(std::memory_order_relaxed);
+            while (record)
+            {
+                delete std::exchange(record, record->next);
+            }
+        }
+
+        std::atomic<Record*> head{nullptr};
+    };
+
+    struct Retired
+    {
+        void* object;
+        void (*destroy)(void*);
+        uint64_t epoch;
+    };
+
+    static constexpr std::size_t ReclaimInterval = 64;
+
+public:
+    class Guard
+    {
+    public:
+        explicit Guard(EpochDomain& t_domain)
+                :
+                m_record(t_domain.LocalRecord())
+        {
+            if (m_record->depth++ == 0)
+            {
+                t_domain.Pin(*m_record);
+            }
+        }
+
+        ~Guard()
+        {
+            if (--m_record->depth == 0)
+            {
+                m_record->state.store(0, std::memory_order_release);
+            }
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        Guard(Guard&&) = delete;
+        Guard& operator=(Guard&&) = delete;
+
+    private:
+        Record* m_record;
+    };
+
+    EpochDomain()
+            :
+            m_id(NextId()),
+            m_registry(std::make_shared<Registry>())
+    {}
+
+    // No reader may be inside a guard any more.
+    ~EpochDomain()
+    {
+        for (Retired& retired : m_retired)
+        {
+            retired.destroy(retired.object);
+        }
+    }
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+    EpochDomain(EpochDomain&&) = delete;
+    EpochDomain& operator=(EpochDomain&&) = delete;
+
+    template<typename T>
+    void Retire(T* t_object)
+    {
+        Retire(t_object, [](void* t_pointer)
+        {
+            delete static_cast<T*>(t_pointer);
+        });
+    }
+
+    // t_object must already be unreachable for readers that start from now on.
+    void Retire(void* t_object, void (*t_destroy)(void*))
+    {
+        std::lock_guard<std::mutex> lock(m_retire_mutex);
+        m_retired.push_back(Retired{t_object, t_destroy, m_epoch.load(std::memory_order_seq_cst)});
+        if (++m_retires_since_reclaim == ReclaimInterval)
+        {
+            ReclaimLocked();
+        }
+    }
+
+    // Frees whatever is safe to free right now.
+    void Reclaim()
+    {
+        std::lock_guard<std::mutex> lock(m_retire_mutex);
+        ReclaimLocked();
+    }
+
+private:
+    void Pin(Record& t_record)
+    {
+        // Store, then check the epoch did not move before the store became
+        // visible; otherwise a writer could have missed us.
+        uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+        while (true)
+        {
+            t_record.state.store((epoch << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const uint64_t current = m_epoch.load(std::memory_order_relaxed);
+            if (current == epoch)
+            {
+                return;
+            }
+            epoch = current;
+        }
+    }
+
+    bool TryAdvance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = m_epoch.load(std::memory_order_relaxed);
+        for (Record* record = m_registry->head.load(std::memory_order_acquire); record; record = record->next)
+        {
+            const uint64_t state = record->state.load(std::memory_order_acquire);
+            if ((state & 1) != 0 && (state >> 1) != epoch)
+            {
+                return false;
+            }
+        }
+        return m_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+    }
+
+    void ReclaimLocked()
+    {
+        m_retires_since_reclaim = 0;
+        TryAdvance();
+        const uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+
+        std::size_t kept = 0;
+        for (Retired& retired : m_retired)
+        {
+            if (retired.epoch + 2 <= epoch)
+            {
+                retired.destroy(retired.object);
+            }
+            else
+            {
+                m_retired[kept++] = retired;
+            }
+        }
+        m_retired.resize(kept);
+    }
+
+    Record* LocalRecord()
+    {
+        struct Entry
+        {
+            uint64_t domainId;
+            std::shared_ptr<Registry> registry;
+            Record* record;
+        };
+
+        struct LocalRecords
+        {
+            ~LocalRecords()
+            {
+                for (Entry& entry : entries)
+                {
+                    entry.record->inUse.store(false, std::memory_order_release);
+                }
+            }
+
+            std::vector<Entry> entries;
+        };
+
+        static thread_local LocalRecords local;
+        for (Entry& entry : local.entries)
+        {
+            if (entry.domainId == m_id)
+            {
+                return entry.record;
+            }
+        }
+
+        // Forget records of domains that no longer exist.
+        for (std::size_t i = 0; i < local.entries.size();)
+        {
+            if (local.entries[i].registry.use_count() == 1)
+            {
+                local.entries[i] = std::move(local.entries.back());
+                local.entries.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        Record* record = AcquireRecord();
+        local.entries.push_back(Entry{m_id, m_registry, record});
+        return record;
+    }
+
+    Record* AcquireRecord()
+    {
+        for (Record* record = m_registry->head.load(std::memory_order_acquire); record; record = record->next)
+        {
+            bool inUse = false;
+            if (!record->inUse.load(std::memory_order_relaxed) &&
+                record->inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire))
+            {
+                return record;
+            }
+        }
+
+        Record* record = new Record();
+        record->next = m_registry->head.load(std::memory_order_relaxed);
+        while (!m_registry->head.compare_exchange_weak(record->next, record, std::memory_order_release,
+                                                       std::memory_order_relaxed))
+        {}
+        return record;
+    }
+
+    static uint64_t NextId()
+    {
+        static std::atomic<uint64_t> nextId{1};
+        return nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    const uint64_t m_id;
+    std::shared_ptr<Registry> m_registry;
+    std::atomic<uint64_t> m_epoch{1};
+    std::vector<Retired> m_retired;
+    std::size_t m_retires_since_reclaim = 0;
+    std::mutex m_retire_mutex;
+};
+
+#endif //THREAD_POOLS_EPOCH_RECLAMATION_H
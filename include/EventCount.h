@@ -0,0 +1,126 @@
+#ifndef THREAD_POOLS_EVENT_COUNT_H
+#define THREAD_POOLS_EVENT_COUNT_H
+
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+
+// Lets a consumer sleep until "something changed" without racing the producer.
+// The consumer calls PrepareWait(), checks its condition once more and then either
+// CancelWait()s or Wait()s with the key. Any notification after PrepareWait()
+// makes the Wait() return, so a wake-up cannot be lost in between.
+// Notifying costs a fence and a load while nobody sleeps.
+class EventCount
+{
+public:
+    typedef uint32_t Key;
+
+    EventCount() = default;
+    ~EventCount() = default;
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+    EventCount(EventCount&&) = delete;
+    EventCount& operator=(EventCount&&) = delete;
+
+    Key PrepareWait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_acquire);
+    }
+
+    void CancelWait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void Wait(Key t_key)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_changed.wait(lock, [this, t_key]
+            {
+                return m_epoch.load(std::memory_order_relaxed) != t_key;
+            });
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // Like Wait(), but gives up at t_deadline. Returns false if it timed out.
+    template<typename Clock, typename Duration>
+    bool WaitUntil(Key t_key, const std::chrono::time_point<Clock, Duration>& t_deadline)
+    {
+        bool changed;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            changed = m_not_changed.wait_until(lock, t_deadline, [this, t_key]
+            {
+                return m_epoch.load(std::memory_order_relaxed) != t_key;
+            });
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return changed;
+    }
+
+    void NotifyOne()
+    {
+        if (HasWaiters())
+        {
+            Advance();
+            m_not_changed.notify_one();
+        }
+    }
+
+    void NotifyAll()
+    {
+        if (HasWaiters())
+        {
+            Advance();
+            m_not_changed.notify_all();
+        }
+    }
+
+    // One epoch bump for a whole batch, waking at most t_count sleepers.
+    void NotifyMany(std::size_t t_count)
+    {
+        if (t_count == 0 || !HasWaiters())
+        {
+            return;
+        }
+
+        Advance();
+        if (t_count >= m_waiters.load(std::memory_order_relaxed))
+        {
+            m_not_changed.notify_all();
+            return;
+        }
+        for (std::size_t i = 0; i < t_count; ++i)
+        {
+            m_not_changed.notify_one();
+        }
+    }
+
+private:
+    bool HasWaiters() const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_waiters.load(std::memory_order_relaxed) != 0;
+    }
+
+    void Advance()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_epoch.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<Key> m_epoch{0};
+    std::atomic<uint32_t> m_waiters{0};
+    std::condition_variable m_not_changed;
+    std::mutex m_mutex;
+};
+
+#endif //THREAD_POOLS_EVENT_COUNT_H
@@ -0,0 +1,40 @@
+#ifndef THREAD_POOLS_FIRST_EXCEPTION_H
+#define THREAD_POOLS_FIRST_EXCEPTION_H
+
+#include <mutex>
+#include <utility>
+#include <exception>
+
+// Keeps the first exception thrown by any of a group of tasks, so that it can be
+// rethrown on the thread that waits for them.
+class FirstException
+{
+public:
+    void Capture()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_exception)
+        {
+            m_exception = std::current_exception();
+        }
+    }
+
+    void RethrowIfAny()
+    {
+        std::exception_ptr exception;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            exception = std::exchange(m_exception, nullptr);
+        }
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+
+private:
+    std::exception_ptr m_exception;
+    std::mutex m_mutex;
+};
+
+#endif //THREAD_POOLS_FIRST_EXCEPTION_H
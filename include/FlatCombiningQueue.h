@@ -0,0 +1,289 @@
+#ifndef THREAD_POOLS_FLAT_COMBINING_QUEUE_H
+#define THREAD_POOLS_FLAT_COMBINING_QUEUE_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <exception>
+
+#include "RingBuffer.h"
+#include "IdlePolicy.h"
+
+namespace detail
+{
+    // Handed out in the order threads first touch a FlatCombiningQueue, so that
+    // up to SlotCount threads start at different slots.
+    inline std::size_t FlatCombiningThreadIndex()
+    {
+        static std::atomic<std::size_t> next{0};
+        static thread_local const std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+}
+
+// Unbounded MPMC queue with the interface of ThreadSafeQueue, for many threads
+// submitting at once (flat combining, Hendler, Incze, Shavit and Tzafrir). A
+// thread publishes its request in its own padded slot and then tries to take
+// the combiner lock. The thread that gets it applies every request it finds in
+// the slots to the RingBuffer, which stays in that core's cache, while the
+// others spin on their own slot until it says Done. The lock and the buffer
+// change hands once per batch instead of once per operation.
+//
+// A thread that finds no free slot near its own, the bulk operations and a
+// failed allocation go through the lock directly. TryDeque() on an empty queue
+// and Size() only read a counter.
+template<class T>
+class FlatCombiningQueue
+{
+    enum State : uint32_t
+    {
+        Free,
+        Claimed,
+        EnqueRequest,
+        DequeRequest,
+        Done
+    };
+
+    struct alignas(64) Slot
+    {
+        std::atomic<uint32_t> state{Free};
+        T* value = nullptr;
+        bool found = false;
+        std::exception_ptr failure;
+    };
+
+    // Test-and-test-and-set, so the waiters only read the lock's line while
+    // a combiner holds it.
+    class alignas(64) SpinLock
+    {
+    public:
+        bool try_lock()
+        {
+            return !m_locked.load(std::memory_order_relaxed) && !m_locked.exchange(true, std::memory_order_acquire);
+        }
+
+        void lock()
+        {
+            for (uint32_t spins = 0; !try_lock(); ++spins)
+            {
+                Backoff(spins);
+            }
+        }
+
+        void unlock()
+        {
+            m_locked.store(false, std::memory_order_release);
+        }
+
+    private:
+        std::atomic_bool m_locked{false};
+    };
+
+    static constexpr std::size_t SlotCount = 128;
+    static constexpr std::size_t SlotProbes = 4;
+    static constexpr std::size_t CombinePasses = 3;
+    static constexpr uint32_t PauseIterations = 64;
+
+public:
+    FlatCombiningQueue() = default;
+    ~FlatCombiningQueue() = default;
+    FlatCombiningQueue(const FlatCombiningQueue&) = delete;
+    FlatCombiningQueue& operator=(const FlatCombiningQueue&) = delete;
+    FlatCombiningQueue(FlatCombiningQueue&&) = delete;
+    FlatCombiningQueue& operator=(FlatCombiningQueue&&) = delete;
+
+    void Enque(T&& val)
+    {
+        Apply(EnqueRequest, val);
+    }
+
+    bool TryEnque(T&& val)
+    {
+        Enque(std::move(val));
+        return true;
+    }
+
+    // A batch is already one lock acquisition, so it skips the slots.
+    template<typename Iterator>
+    void EnqueBulk(Iterator first, Iterator last)
+    {
+        std::lock_guard<SpinLock> lock(m_lock);
+        try
+        {
+            for (; first != last; ++first)
+            {
+                m_buffer.PushBack(std::move(*first));
+            }
+        }
+        catch (...)
+        {
+            PublishSize();
+            throw;
+        }
+        PublishSize();
+    }
+
+    template<typename Iterator>
+    Iterator TryEnqueBulk(Iterator first, Iterator last)
+    {
+        EnqueBulk(first, last);
+        return last;
+    }
+
+    bool TryDeque(T& val)
+    {
+        if (m_size.load(std::memory_order_seq_cst) == 0)
+        {
+            return false;
+        }
+        return Apply(DequeRequest, val);
+    }
+
+    std::size_t Size() const
+    {
+        return m_size.load(std::memory_order_seq_cst);
+    }
+
+private:
+    static void Backoff(uint32_t t_spins)
+    {
+        if (t_spins < PauseIterations)
+        {
+            CpuRelax();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // Returns what the request found: always true for an enqueue.
+    bool Apply(State t_request, T& t_value)
+    {
+        Slot* slot = Claim();
+        if (!slot)
+        {
+            std::lock_guard<SpinLock> lock(m_lock);
+            return Run(t_request, t_value);
+        }
+
+        slot->value = &t_value;
+        slot->state.store(t_request, std::memory_order_release);
+        for (uint32_t spins = 0; slot->state.load(std::memory_order_acquire) != Done; ++spins)
+        {
+            std::unique_lock<SpinLock> lock(m_lock, std::try_to_lock);
+            if (lock.owns_lock())
+            {
+                Combine();
+            }
+            else
+            {
+                Backoff(spins);
+            }
+        }
+
+        const bool found = slot->found;
+        std::exception_ptr failure = std::exchange(slot->failure, nullptr);
+        slot->state.store(Free, std::memory_order_release);
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+        return found;
+    }
+
+    Slot* Claim()
+    {
+        const std::size_t first = detail::FlatCombiningThreadIndex();
+        for (std::size_t probe = 0; probe < SlotProbes; ++probe)
+        {
+            const std::size_t index = (first + probe) % SlotCount;
+            Slot& slot = m_slots[index];
+            uint32_t expected = Free;
+            if (slot.state.load(std::memory_order_relaxed) == Free &&
+                slot.state.compare_exchange_strong(expected, Claimed, std::memory_order_acquire))
+            {
+                std::size_t used = m_slotsUsed.load(std::memory_order_relaxed);
+                while (used <= index &&
+                       !m_slotsUsed.compare_exchange_weak(used, index + 1, std::memory_order_release))
+                {}
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    // Caller holds m_lock. Goes over the slots in use again as long as the
+    // previous pass found something, up to CombinePasses times.
+    void Combine()
+    {
+        const std::size_t used = m_slotsUsed.load(std::memory_order_acquire);
+        for (std::size_t pass = 0; pass < CombinePasses; ++pass)
+        {
+            std::size_t applied = 0;
+            for (std::size_t i = 0; i < used; ++i)
+            {
+                Slot& slot = m_slots[i];
+                const uint32_t state = slot.state.load(std::memory_order_acquire);
+                if (state != EnqueRequest && state != DequeRequest)
+                {
+                    continue;
+                }
+
+                try
+                {
+                    slot.found = Run(static_cast<State>(state), *slot.value);
+                }
+                catch (...)
+                {
+                    slot.failure = std::current_exception();
+                }
+                slot.state.store(Done, std::memory_order_release);
+                ++applied;
+            }
+            if (applied == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    // Caller holds m_lock.
+    bool Run(State t_request, T& t_value)
+    {
+        if (t_request == EnqueRequest)
+        {
+            m_buffer.PushBack(std::move(t_value));
+        }
+        else if (m_buffer.Empty())
+        {
+            return false;
+        }
+        else
+        {
+            t_value = std::move(m_buffer.Front());
+            m_buffer.PopFront();
+        }
+        PublishSize();
+        return true;
+    }
+
+    // Before the request is marked Done, so that a producer's notification
+    // cannot overtake the counter a parking consumer checks.
+    void PublishSize()
+    {
+        m_size.store(m_buffer.Size(), std::memory_order_seq_cst);
+    }
+
+private:
+    SpinLock m_lock;
+    RingBuffer<T> m_buffer;
+    alignas(64) std::atomic<std::size_t> m_size{0};
+    std::atomic<std::size_t> m_slotsUsed{0};
+    Slot m_slots[SlotCount];
+};
+
+#endif //THREAD_POOLS_FLAT_COMBINING_QUEUE_H
@@ -0,0 +1,86 @@
+#ifndef THREAD_POOLS_FREE_LIST_H
+#define THREAD_POOLS_FREE_LIST_H
+
+#include <new>
+#include <cstddef>
+#include <type_traits>
+
+// Per-thread cache of raw blocks big enough for a T. A block can be released on
+// any thread; it simply joins that thread's list. Nothing here is shared, so no
+// synchronization is needed. Each list keeps at most Capacity blocks.
+template<typename T, std::size_t Capacity = 1024>
+class ThreadLocalFreeList
+{
+    struct Node
+    {
+        Node* next;
+    };
+
+    typedef std::aligned_storage_t<(sizeof(T) > sizeof(Node) ? sizeof(T) : sizeof(Node)),
+                                   (alignof(T) > alignof(Node) ? alignof(T) : alignof(Node))> block_type;
+
+    // Trivially destructible, so it stays usable while other thread_local
+    // objects of the same thread are being destroyed.
+    struct State
+    {
+        Node* head;
+        std::size_t count;
+        bool closed;
+    };
+
+    struct Reaper
+    {
+        ~Reaper()
+        {
+            State& state = Local();
+            state.closed = true;
+            while (state.head)
+            {
+                Node* node = state.head;
+                state.head = node->next;
+                delete reinterpret_cast<block_type*>(node);
+            }
+            state.count = 0;
+        }
+    };
+
+public:
+    static void* Allocate()
+    {
+        State& state = Local();
+        if (state.head)
+        {
+            Node* node = state.head;
+            state.head = node->next;
+            --state.count;
+            return node;
+        }
+        return new block_type;
+    }
+
+    static void Deallocate(void* t_block)
+    {
+        State& state = Local();
+        if (state.closed || state.count == Capacity)
+        {
+            delete static_cast<block_type*>(t_block);
+            return;
+        }
+
+        static thread_local Reaper reaper;
+        (void)reaper;
+
+        Node* node = ::new (t_block) Node{state.head};
+        state.head = node;
+        ++state.count;
+    }
+
+private:
+    static State& Local()
+    {
+        static thread_local State state{nullptr, 0, false};
+        return state;
+    }
+};
+
+#endif //THREAD_POOLS_FREE_LIST_H
@@ -1,61 +1,186 @@
 #ifndef FUNCTION_WRAPPER_H
 #define FUNCTION_WRAPPER_H
 
-#include <memory>
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
 
+#ifdef THREAD_POOL_STATS
+#include <chrono>
+#endif //THREAD_POOL_STATS
+
+// Move-only void() callable. Callables that fit into the inline buffer (the whole
+// wrapper is one cache line) are stored in place, bigger ones go to the heap.
+// Dispatch goes through a static table of function pointers per callable type.
+// With THREAD_POOL_STATS the wrapper also remembers when it was enqueued, and
+// the buffer shrinks by the timestamp so that it still fits the line.
 class FunctionWrapper
 {
-    struct ImplementBase
+#ifdef THREAD_POOL_STATS
+    static constexpr std::size_t InlineSize = 64 - sizeof(void*) - sizeof(std::chrono::steady_clock::time_point);
+#else
+    static constexpr std::size_t InlineSize = 64 - sizeof(void*);
+#endif //THREAD_POOL_STATS
+    static constexpr std::size_t InlineAlign = alignof(std::max_align_t);
+
+    struct Operations
+    {
+        void (*call)(void*);
+        void (*move)(void* t_to, void* t_from);
+        void (*destroy)(void*);
+    };
+
+    template<typename F>
+    struct InlineOperations
     {
-        virtual void Call() = 0;
-        virtual ~ImplementBase() {}
+        static void Call(void* t_storage)
+        {
+            (*static_cast<F*>(t_storage))();
+        }
+
+        static void Move(void* t_to, void* t_from)
+        {
+            F* from = static_cast<F*>(t_from);
+            ::new (t_to) F(std::move(*from));
+            from->~F();
+        }
+
+        static void Destroy(void* t_storage)
+        {
+            static_cast<F*>(t_storage)->~F();
+        }
+
+        static constexpr Operations table{&Call, &Move, &Destroy};
     };
 
     template<typename F>
-    struct ImplementType : ImplementBase
+    struct HeapOperations
     {
-        F m_f;
-        ImplementType(F&& t_f)
-                :
-                m_f(std::move(t_f))
-        {}
+        static void Call(void* t_storage)
+        {
+            (**static_cast<F**>(t_storage))();
+        }
+
+        static void Move(void* t_to, void* t_from)
+        {
+            ::new (t_to) F*(*static_cast<F**>(t_from));
+        }
 
-        void Call()
+        static void Destroy(void* t_storage)
         {
-            m_f();
+            delete *static_cast<F**>(t_storage);
         }
+
+        static constexpr Operations table{&Call, &Move, &Destroy};
     };
 
+    template<typename F>
+    static constexpr bool FitsInline = sizeof(F) <= InlineSize &&
+                                       alignof(F) <= InlineAlign &&
+                                       std::is_nothrow_move_constructible_v<F>;
+
 public:
     FunctionWrapper() = default;
     FunctionWrapper(const FunctionWrapper&) = delete;
     FunctionWrapper(FunctionWrapper&) = delete;
     FunctionWrapper& operator=(const FunctionWrapper&) = delete;
 
-    template<typename F>
+    template<typename F,
+             typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, FunctionWrapper>>>
     FunctionWrapper(F&& f)
-            :
-            m_implement(new ImplementType<F>(std::forward<F>(f)))
-    {}
+    {
+        typedef std::decay_t<F> function_type;
 
-    FunctionWrapper(FunctionWrapper&& other)
-            :
-            m_implement(std::move(other.m_implement))
-    {}
+        if constexpr (FitsInline<function_type>)
+        {
+            ::new (static_cast<void*>(m_storage)) function_type(std::forward<F>(f));
+            m_operations = &InlineOperations<function_type>::table;
+        }
+        else
+        {
+            ::new (static_cast<void*>(m_storage)) function_type*(new function_type(std::forward<F>(f)));
+            m_operations = &HeapOperations<function_type>::table;
+        }
+        MarkEnqueued();
+    }
 
-    FunctionWrapper& operator=(FunctionWrapper&& other)
+    FunctionWrapper(FunctionWrapper&& other) noexcept
     {
-        m_implement = std::move(other.m_implement);
+        MoveFrom(other);
+    }
+
+    FunctionWrapper& operator=(FunctionWrapper&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            MoveFrom(other);
+        }
         return *this;
     }
 
+    ~FunctionWrapper()
+    {
+        Reset();
+    }
+
     void operator()()
     {
-        m_implement->Call();
+        m_operations->call(m_storage);
+    }
+
+    explicit operator bool() const
+    {
+        return m_operations != nullptr;
+    }
+
+    // For tasks that were wrapped long before they were queued (timers).
+    void MarkEnqueued()
+    {
+#ifdef THREAD_POOL_STATS
+        m_enqueued = std::chrono::steady_clock::now();
+#endif //THREAD_POOL_STATS
+    }
+
+#ifdef THREAD_POOL_STATS
+    std::chrono::steady_clock::time_point EnqueuedAt() const
+    {
+        return m_enqueued;
+    }
+#endif //THREAD_POOL_STATS
+
+private:
+    void MoveFrom(FunctionWrapper& other)
+    {
+        if (other.m_operations)
+        {
+            other.m_operations->move(m_storage, other.m_storage);
+            m_operations = other.m_operations;
+            other.m_operations = nullptr;
+#ifdef THREAD_POOL_STATS
+            m_enqueued = other.m_enqueued;
+#endif //THREAD_POOL_STATS
+        }
+    }
+
+    void Reset()
+    {
+        if (m_operations)
+        {
+            m_operations->destroy(m_storage);
+            m_operations = nullptr;
+        }
     }
 
 private:
-    std::unique_ptr<ImplementBase> m_implement;
+    alignas(InlineAlign) unsigned char m_storage[InlineSize];
+    const Operations* m_operations = nullptr;
+#ifdef THREAD_POOL_STATS
+    std::chrono::steady_clock::time_point m_enqueued;
+#endif //THREAD_POOL_STATS
 };
 
+static_assert(sizeof(FunctionWrapper) == 64, "FunctionWrapper must be one cache line");
+
 #endif // FUNCTION_WRAPPER_H
@@ -0,0 +1,145 @@
+#ifndef THREAD_POOLS_FUTEX_EVENT_COUNT_H
+#define THREAD_POOLS_FUTEX_EVENT_COUNT_H
+
+#include "EventCount.h"
+
+#ifdef __linux__
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// EventCount with the same protocol, but the sleepers wait on a futex on the
+// epoch word itself instead of a mutex and a condition variable. A notification
+// is one atomic increment and one FUTEX_WAKE, and a woken worker goes straight
+// back to work without taking a lock first. A Wait() whose key is already stale
+// returns at once because the kernel compares the word before it sleeps.
+// Everywhere else FutexEventCount is EventCount.
+class FutexEventCount
+{
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "a futex is a plain 32-bit word");
+
+public:
+    typedef uint32_t Key;
+
+    FutexEventCount() = default;
+    ~FutexEventCount() = default;
+    FutexEventCount(const FutexEventCount&) = delete;
+    FutexEventCount& operator=(const FutexEventCount&) = delete;
+    FutexEventCount(FutexEventCount&&) = delete;
+    FutexEventCount& operator=(FutexEventCount&&) = delete;
+
+    Key PrepareWait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_acquire);
+    }
+
+    void CancelWait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void Wait(Key t_key)
+    {
+        while (m_epoch.load(std::memory_order_acquire) == t_key)
+        {
+            FutexWait(t_key, nullptr);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // Like Wait(), but gives up at t_deadline. Returns false if it timed out.
+    template<typename Clock, typename Duration>
+    bool WaitUntil(Key t_key, const std::chrono::time_point<Clock, Duration>& t_deadline)
+    {
+        bool changed = false;
+        while (!(changed = m_epoch.load(std::memory_order_acquire) != t_key))
+        {
+            const auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(t_deadline - Clock::now());
+            if (remaining.count() <= 0)
+            {
+                break;
+            }
+            timespec timeout;
+            timeout.tv_sec = static_cast<time_t>(remaining.count() / 1000000000);
+            timeout.tv_nsec = static_cast<long>(remaining.count() % 1000000000);
+            FutexWait(t_key, &timeout);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return changed;
+    }
+
+    void NotifyOne()
+    {
+        if (HasWaiters())
+        {
+            Advance();
+            FutexWake(1);
+        }
+    }
+
+    void NotifyAll()
+    {
+        if (HasWaiters())
+        {
+            Advance();
+            FutexWake(INT_MAX);
+        }
+    }
+
+    // One epoch bump for a whole batch, waking at most t_count sleepers.
+    void NotifyMany(std::size_t t_count)
+    {
+        if (t_count == 0 || !HasWaiters())
+        {
+            return;
+        }
+
+        Advance();
+        FutexWake(t_count < static_cast<std::size_t>(INT_MAX) ? static_cast<int>(t_count) : INT_MAX);
+    }
+
+private:
+    bool HasWaiters() const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_waiters.load(std::memory_order_relaxed) != 0;
+    }
+
+    void Advance()
+    {
+        m_epoch.fetch_add(1, std::memory_order_release);
+    }
+
+    // Returns on a wake-up, a timeout, a signal or when the epoch has already
+    // moved on; the callers check the epoch again in every case.
+    void FutexWait(Key t_key, const timespec* t_timeout)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, t_key, t_timeout, nullptr, 0);
+    }
+
+    void FutexWake(int t_count)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAKE_PRIVATE, t_count, nullptr, nullptr, 0);
+    }
+
+private:
+    std::atomic<Key> m_epoch{0};
+    std::atomic<uint32_t> m_waiters{0};
+};
+
+#else
+
+typedef EventCount FutexEventCount;
+
+#endif //__linux__
+
+#endif //THREAD_POOLS_FUTEX_EVENT_COUNT_H
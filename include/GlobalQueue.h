@@ -0,0 +1,19 @@
+#ifndef THREAD_POOLS_GLOBAL_QUEUE_H
+#define THREAD_POOLS_GLOBAL_QUEUE_H
+
+// The unbounded queue a pool's workers share and external threads submit to:
+// ThreadSafeQueue (one mutex) by default, FlatCombiningQueue when built with
+// FLAT_COMBINING_GLOBAL_QUEUE.
+#ifdef FLAT_COMBINING_GLOBAL_QUEUE
+#include "FlatCombiningQueue.h"
+
+template<class T>
+using DefaultGlobalQueue = FlatCombiningQueue<T>;
+#else
+#include "ThreadSafeQueue.h"
+
+template<class T>
+using DefaultGlobalQueue = ThreadSafeQueue<T>;
+#endif //FLAT_COMBINING_GLOBAL_QUEUE
+
+#endif //THREAD_POOLS_GLOBAL_QUEUE_H
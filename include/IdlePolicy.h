@@ -0,0 +1,119 @@
+#ifndef THREAD_POOLS_IDLE_POLICY_H
+#define THREAD_POOLS_IDLE_POLICY_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+
+#include "EventCount.h"
+#include "WorkerStats.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#endif //_MSC_VER
+
+// What a worker does when it finds no work: a few pause instructions, then
+// yields until spinTime is used up, then it parks until Submit() wakes it.
+// With park switched off the worker keeps yielding forever.
+struct IdlePolicy
+{
+    uint32_t pauseIterations = 64;
+    std::chrono::microseconds spinTime{200};
+    bool park = true;
+};
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+class IdleBackoff
+{
+public:
+    explicit IdleBackoff(const IdlePolicy& t_policy)
+            :
+            m_policy(t_policy)
+    {}
+
+    void Reset()
+    {
+        m_spins = 0;
+    }
+
+    // Returns false once the spin budget is used up and the caller should park.
+    bool Spin()
+    {
+        if (m_spins++ < m_policy.pauseIterations)
+        {
+            CpuRelax();
+            return true;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (m_spins == m_policy.pauseIterations + 1)
+        {
+            m_yieldStart = now;
+        }
+
+        if (!m_policy.park || now - m_yieldStart < m_policy.spinTime)
+        {
+            std::this_thread::yield();
+            return true;
+        }
+
+        return false;
+    }
+
+private:
+    const IdlePolicy& m_policy;
+    uint32_t m_spins = 0;
+    std::chrono::steady_clock::time_point m_yieldStart;
+};
+
+// Main loop shared by the workers: run tasks while there are any, spin for a
+// while when there are none, then sleep on t_wakeup, an EventCount or anything
+// with its interface. t_runPendingTask returns whether it ran something.
+// Spinning and parking are counted in t_stats.
+template<typename Event, typename RunPendingTask>
+void RunWorkerLoop(const std::atomic_bool& t_done, Event& t_wakeup, const IdlePolicy& t_policy,
+                   WorkerStats& t_stats, RunPendingTask&& t_runPendingTask)
+{
+    IdleBackoff backoff(t_policy);
+
+    while (!t_done)
+    {
+        if (t_runPendingTask())
+        {
+            backoff.Reset();
+            continue;
+        }
+
+        if (backoff.Spin())
+        {
+            t_stats.Spin();
+            continue;
+        }
+
+        const typename Event::Key key = t_wakeup.PrepareWait();
+        if (t_done || t_runPendingTask())
+        {
+            t_wakeup.CancelWait();
+        }
+        else
+        {
+            t_stats.Parking();
+            t_wakeup.Wait(key);
+            t_stats.Woken();
+        }
+        backoff.Reset();
+    }
+}
+
+#endif //THREAD_POOLS_IDLE_POLICY_H
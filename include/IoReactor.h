@@ -0,0 +1,711 @@
+#ifndef THREAD_POOLS_IO_REACTOR_H
+#define THREAD_POOLS_IO_REACTOR_H
+
+#ifdef __linux__
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <iterator>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "FunctionWrapper.h"
+#include "TaskFuture.h"
+
+// What IoReactor waits with. IoUring falls back to Epoll when the kernel
+// refuses to set up a ring (too old, or io_uring switched off).
+enum class IoBackend
+{
+    Epoll,
+    IoUring
+};
+
+// Lets pool tasks wait for I/O without holding a worker. Every operation
+// returns a TaskFuture. Once the I/O is done the future is fulfilled on a
+// worker of the pool the reactor was made for (or right away by the caller if
+// the operation did not have to wait), so Then(pool, ...) or WaitFor() carry on
+// from there. One thread per reactor waits for the kernel.
+//
+// With Epoll, Read() and Write() first try the system call on the calling
+// thread; only if it would block is the descriptor registered, and the retry
+// runs on a worker once it is ready. Pipes and sockets must therefore be
+// O_NONBLOCK. Regular files are always ready, so there the call simply happens
+// right away. With IoUring the kernel does the transfer itself, regular files
+// included, and the worker only fulfils the future.
+//
+// A failed operation ends with std::system_error. Cancel(fd) ends all pending
+// operations on fd with ECANCELED; call it before closing a descriptor that
+// still has some. The reactor must outlive its operations, and the pool must
+// outlive the reactor.
+class IoReactor
+{
+    enum class Kind : uint8_t
+    {
+        Readable,
+        Writable,
+        Read,
+        Write
+    };
+
+    // One pending request. result is what the system call returned, or -errno.
+    struct Operation
+    {
+        Operation(Kind t_kind, int t_fd, void* t_buffer, std::size_t t_size, int64_t t_offset)
+                :
+                kind(t_kind),
+                fd(t_fd),
+                buffer(t_buffer),
+                size(t_size),
+                offset(t_offset)
+        {}
+
+        virtual ~Operation() = default;
+
+        // Hands result over to the future.
+        virtual void Finish() = 0;
+
+        bool IsInput() const
+        {
+            return kind == Kind::Readable || kind == Kind::Read;
+        }
+
+        bool IsTransfer() const
+        {
+            return kind == Kind::Read || kind == Kind::Write;
+        }
+
+        const Kind kind;
+        const int fd;
+        void* const buffer;
+        const std::size_t size;
+        // -1 for the current file position.
+        const int64_t offset;
+        long result = 0;
+        // IoUring only: the descriptor was not ready, so a poll runs before the retry.
+        bool polling = false;
+        // IoUring only, under m_mutex: Cancel() has asked the kernel to stop it.
+        bool cancelled = false;
+    };
+
+    template<typename T>
+    struct PromisedOperation : Operation
+    {
+        using Operation::Operation;
+
+        void Finish() override
+        {
+            if (result < 0)
+            {
+                promise.SetException(std::make_exception_ptr(std::system_error(
+                        static_cast<int>(-result), std::generic_category(),
+                        IsTransfer() ? (IsInput() ? "read" : "write") : "poll")));
+            }
+            else if constexpr (std::is_void_v<T>)
+            {
+                promise.SetValue();
+            }
+            else
+            {
+                promise.SetValue(static_cast<T>(result));
+            }
+        }
+
+        TaskPromise<T> promise;
+    };
+
+    // Epoll only: who waits for a registered descriptor.
+    struct Interest
+    {
+        std::vector<std::unique_ptr<Operation>> readers;
+        std::vector<std::unique_ptr<Operation>> writers;
+        uint32_t events = 0;
+    };
+
+    static constexpr unsigned RingEntries = 256;
+    static constexpr std::size_t EpollBatch = 64;
+
+public:
+    typedef std::function<void(FunctionWrapper&&)> sink_type;
+
+    template<typename Pool>
+    explicit IoReactor(Pool& t_pool, IoBackend t_backend = IoBackend::Epoll)
+        : IoReactor(sink_type([&t_pool](FunctionWrapper&& t_task) { t_pool.Post(std::move(t_task)); }), t_backend)
+    {}
+
+    // Throws std::system_error if neither backend can be set up.
+    IoReactor(sink_type t_sink, IoBackend t_backend)
+        : m_sink(std::move(t_sink))
+    {
+        if (t_backend == IoBackend::IoUring && SetUpRing())
+        {
+            m_backend = IoBackend::IoUring;
+            m_thread = std::thread(&IoReactor::RunRing, this);
+        }
+        else
+        {
+            SetUpEpoll();
+            m_thread = std::thread(&IoReactor::RunEpoll, this);
+        }
+    }
+
+    // Operations still pending end with a broken promise.
+    ~IoReactor()
+    {
+        m_stopping.store(true);
+        if (m_backend == IoBackend::IoUring)
+        {
+            Submit(nullptr);
+        }
+        else
+        {
+            const uint64_t one = 1;
+            (void) !write(m_wakeup, &one, sizeof(one));
+        }
+        m_thread.join();
+
+        if (m_backend == IoBackend::IoUring)
+        {
+            close(m_ringFd);
+            munmap(m_sqes, m_sqEntries * sizeof(io_uring_sqe));
+            munmap(m_ring, m_ringSize);
+            for (Operation* operation : m_inFlight)
+            {
+                delete operation;
+            }
+        }
+        else
+        {
+            close(m_wakeup);
+            close(m_epoll);
+        }
+    }
+
+    IoReactor(const IoReactor&) = delete;
+    IoReactor& operator=(const IoReactor&) = delete;
+    IoReactor(IoReactor&&) = delete;
+    IoReactor& operator=(IoReactor&&) = delete;
+
+    IoBackend Backend() const
+    {
+        return m_backend;
+    }
+
+    // Ready once fd can be read without blocking, or has hung up.
+    TaskFuture<void> WaitReadable(int t_fd)
+    {
+        return Start<void>(Kind::Readable, t_fd, nullptr, 0, -1);
+    }
+
+    TaskFuture<void> WaitWritable(int t_fd)
+    {
+        return Start<void>(Kind::Writable, t_fd, nullptr, 0, -1);
+    }
+
+    // Like read(): the number of bytes read, 0 at the end of the file.
+    TaskFuture<std::size_t> Read(int t_fd, void* t_buffer, std::size_t t_size)
+    {
+        return Start<std::size_t>(Kind::Read, t_fd, t_buffer, t_size, -1);
+    }
+
+    TaskFuture<std::size_t> ReadAt(int t_fd, void* t_buffer, std::size_t t_size, int64_t t_offset)
+    {
+        return Start<std::size_t>(Kind::Read, t_fd, t_buffer, t_size, t_offset);
+    }
+
+    // Like write(): the number of bytes written, which may be less than t_size.
+    TaskFuture<std::size_t> Write(int t_fd, const void* t_buffer, std::size_t t_size)
+    {
+        return Start<std::size_t>(Kind::Write, t_fd, const_cast<void*>(t_buffer), t_size, -1);
+    }
+
+    TaskFuture<std::size_t> WriteAt(int t_fd, const void* t_buffer, std::size_t t_size, int64_t t_offset)
+    {
+        return Start<std::size_t>(Kind::Write, t_fd, const_cast<void*>(t_buffer), t_size, t_offset);
+    }
+
+    void Cancel(int t_fd)
+    {
+        if (m_backend == IoBackend::IoUring)
+        {
+            // One cancel per operation, by its address: cancelling by descriptor
+            // needs Linux 5.19. The cancel itself completes with user_data 0.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (Operation* operation : m_inFlight)
+            {
+                if (operation->fd != t_fd || operation->cancelled)
+                {
+                    continue;
+                }
+                operation->cancelled = true;
+                io_uring_sqe& sqe = NextSqe();
+                sqe.opcode = IORING_OP_ASYNC_CANCEL;
+                sqe.addr = reinterpret_cast<uint64_t>(operation);
+                EnterSqe();
+            }
+            return;
+        }
+
+        std::vector<std::unique_ptr<Operation>> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_interest.find(t_fd);
+            if (found == m_interest.end())
+            {
+                return;
+            }
+            Interest& interest = found->second;
+            std::move(interest.readers.begin(), interest.readers.end(), std::back_inserter(cancelled));
+            std::move(interest.writers.begin(), interest.writers.end(), std::back_inserter(cancelled));
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, t_fd, nullptr);
+            m_interest.erase(found);
+        }
+        for (auto& operation : cancelled)
+        {
+            operation->result = -ECANCELED;
+            operation->Finish();
+        }
+    }
+
+private:
+    template<typename T>
+    TaskFuture<T> Start(Kind t_kind, int t_fd, void* t_buffer, std::size_t t_size, int64_t t_offset)
+    {
+        auto operation = std::make_unique<PromisedOperation<T>>(t_kind, t_fd, t_buffer, t_size, t_offset);
+        TaskFuture<T> result(operation->promise.GetFuture());
+        if (m_backend == IoBackend::IoUring)
+        {
+            Submit(operation.release());
+        }
+        else
+        {
+            Attempt(std::move(operation));
+        }
+        return result;
+    }
+
+    // Hands a finished operation to a worker.
+    void Complete(std::unique_ptr<Operation> t_operation)
+    {
+        m_sink(FunctionWrapper([operation = std::move(t_operation)]()
+        {
+            operation->Finish();
+        }));
+    }
+
+    // --- epoll ---
+
+    void SetUpEpoll()
+    {
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+        }
+        m_wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (m_wakeup < 0)
+        {
+            const int error = errno;
+            close(m_epoll);
+            throw std::system_error(error, std::generic_category(), "eventfd");
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = m_wakeup;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &event);
+    }
+
+    static long Transfer(const Operation& t_operation)
+    {
+        ssize_t result;
+        do
+        {
+            if (t_operation.kind == Kind::Read)
+            {
+                result = t_operation.offset < 0
+                         ? read(t_operation.fd, t_operation.buffer, t_operation.size)
+                         : pread(t_operation.fd, t_operation.buffer, t_operation.size, t_operation.offset);
+            }
+            else
+            {
+                result = t_operation.offset < 0
+                         ? write(t_operation.fd, t_operation.buffer, t_operation.size)
+                         : pwrite(t_operation.fd, t_operation.buffer, t_operation.size, t_operation.offset);
+            }
+        } while (result < 0 && errno == EINTR);
+        return result < 0 ? -errno : static_cast<long>(result);
+    }
+
+    // Does the transfer if it does not block, otherwise waits for the descriptor.
+    void Attempt(std::unique_ptr<Operation> t_operation)
+    {
+        if (t_operation->IsTransfer())
+        {
+            const long result = Transfer(*t_operation);
+            if (result != -EAGAIN && result != -EWOULDBLOCK)
+            {
+                t_operation->result = result;
+                t_operation->Finish();
+                return;
+            }
+        }
+        Arm(std::move(t_operation));
+    }
+
+    void Arm(std::unique_ptr<Operation> t_operation)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const int fd = t_operation->fd;
+        Interest& interest = m_interest[fd];
+        const bool input = t_operation->IsInput();
+        (input ? interest.readers : interest.writers).push_back(std::move(t_operation));
+        const int error = Register(fd, interest);
+        if (error == 0)
+        {
+            return;
+        }
+
+        // Only a new descriptor can fail, so the operation is alone in there.
+        std::unique_ptr<Operation> operation = std::move((input ? interest.readers : interest.writers).back());
+        (input ? interest.readers : interest.writers).pop_back();
+        if (interest.events == 0)
+        {
+            m_interest.erase(fd);
+        }
+        lock.unlock();
+
+        // epoll refuses regular files with EPERM; they are always ready.
+        if (error == EPERM)
+        {
+            Resume(std::move(operation));
+            return;
+        }
+        operation->result = -error;
+        operation->Finish();
+    }
+
+    // Brings the registration of t_fd in line with who waits for it. Returns 0 or an errno.
+    int Register(int t_fd, Interest& t_interest)
+    {
+        const uint32_t events = (t_interest.readers.empty() ? 0u : uint32_t(EPOLLIN)) |
+                                (t_interest.writers.empty() ? 0u : uint32_t(EPOLLOUT));
+        if (events == t_interest.events)
+        {
+            return 0;
+        }
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = t_fd;
+        const int operation = t_interest.events == 0 ? EPOLL_CTL_ADD : (events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD);
+        if (epoll_ctl(m_epoll, operation, t_fd, &event) != 0 && operation != EPOLL_CTL_DEL)
+        {
+            return errno;
+        }
+        t_interest.events = events;
+        return 0;
+    }
+
+    // On a worker: a transfer is tried again, a wait is over.
+    void Resume(std::unique_ptr<Operation> t_operation)
+    {
+        m_sink(FunctionWrapper([this, operation = std::move(t_operation)]() mutable
+        {
+            if (operation->IsTransfer())
+            {
+                Attempt(std::move(operation));
+            }
+            else
+            {
+                operation->Finish();
+            }
+        }));
+    }
+
+    void RunEpoll()
+    {
+        std::array<epoll_event, EpollBatch> events;
+        std::vector<std::unique_ptr<Operation>> ready;
+
+        while (!m_stopping.load())
+        {
+            const int count = epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()), -1);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (int i = 0; i < count; ++i)
+                {
+                    auto found = m_interest.find(events[i].data.fd);
+                    if (events[i].data.fd == m_wakeup || found == m_interest.end())
+                    {
+                        continue;
+                    }
+                    Interest& interest = found->second;
+                    const uint32_t happened = events[i].events;
+                    if (happened & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                    {
+                        std::move(interest.readers.begin(), interest.readers.end(), std::back_inserter(ready));
+                        interest.readers.clear();
+                    }
+                    if (happened & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                    {
+                        std::move(interest.writers.begin(), interest.writers.end(), std::back_inserter(ready));
+                        interest.writers.clear();
+                    }
+                    Register(found->first, interest);
+                    if (interest.events == 0)
+                    {
+                        m_interest.erase(found);
+                    }
+                }
+            }
+            for (auto& operation : ready)
+            {
+                Resume(std::move(operation));
+            }
+            ready.clear();
+        }
+    }
+
+    // --- io_uring ---
+
+    static int RingSetup(unsigned t_entries, io_uring_params* t_params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, t_entries, t_params));
+    }
+
+    static int RingEnter(int t_fd, unsigned t_submit, unsigned t_wait, unsigned t_flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, t_fd, t_submit, t_wait, t_flags, nullptr, 0));
+    }
+
+    static unsigned* RingWord(void* t_ring, uint32_t t_offset)
+    {
+        return reinterpret_cast<unsigned*>(static_cast<char*>(t_ring) + t_offset);
+    }
+
+    bool SetUpRing()
+    {
+        io_uring_params params{};
+        m_ringFd = RingSetup(RingEntries, &params);
+        if (m_ringFd < 0)
+        {
+            return false;
+        }
+        // Older kernels map the two rings separately; they also lack
+        // IORING_OP_READ and the like, so they get epoll.
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+        {
+            close(m_ringFd);
+            return false;
+        }
+
+        m_ringSize = std::max<std::size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                           params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        m_ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd,
+                      IORING_OFF_SQ_RING);
+        if (m_ring == MAP_FAILED)
+        {
+            close(m_ringFd);
+            return false;
+        }
+        void* sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            munmap(m_ring, m_ringSize);
+            close(m_ringFd);
+            return false;
+        }
+
+        m_sqes = static_cast<io_uring_sqe*>(sqes);
+        m_sqEntries = params.sq_entries;
+        m_sqTail = RingWord(m_ring, params.sq_off.tail);
+        m_sqMask = *RingWord(m_ring, params.sq_off.ring_mask);
+        m_sqArray = RingWord(m_ring, params.sq_off.array);
+        m_cqHead = RingWord(m_ring, params.cq_off.head);
+        m_cqTail = RingWord(m_ring, params.cq_off.tail);
+        m_cqMask = *RingWord(m_ring, params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(m_ring) + params.cq_off.cqes);
+        return true;
+    }
+
+    // Caller holds m_mutex. Every entry is submitted right away, so the
+    // submission ring never holds more than one.
+    io_uring_sqe& NextSqe()
+    {
+        const unsigned index = *m_sqTail & m_sqMask;
+        io_uring_sqe& sqe = m_sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        m_sqArray[index] = index;
+        return sqe;
+    }
+
+    // Caller holds m_mutex. Returns 0 or an errno.
+    int EnterSqe()
+    {
+        __atomic_store_n(m_sqTail, *m_sqTail + 1, __ATOMIC_RELEASE);
+        for (;;)
+        {
+            if (RingEnter(m_ringFd, 1, 0, 0) >= 0)
+            {
+                return 0;
+            }
+            const int error = errno;
+            if (error != EINTR && error != EAGAIN && error != EBUSY)
+            {
+                // Not taken: withdraw the entry.
+                __atomic_store_n(m_sqTail, *m_sqTail - 1, __ATOMIC_RELEASE);
+                return error;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // A null t_operation is a no-op that wakes the reaper.
+    void Submit(Operation* t_operation)
+    {
+        int error;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (t_operation && t_operation->cancelled)
+            {
+                // Cancelled between the poll and the retry.
+                error = ECANCELED;
+            }
+            else
+            {
+                io_uring_sqe& sqe = NextSqe();
+                sqe.user_data = reinterpret_cast<uint64_t>(t_operation);
+                if (!t_operation)
+                {
+                    sqe.opcode = IORING_OP_NOP;
+                }
+                else if (!t_operation->IsTransfer() || t_operation->polling)
+                {
+                    sqe.opcode = IORING_OP_POLL_ADD;
+                    sqe.fd = t_operation->fd;
+                    sqe.poll32_events = t_operation->IsInput() ? POLLIN : POLLOUT;
+                }
+                else
+                {
+                    sqe.opcode = t_operation->kind == Kind::Read ? IORING_OP_READ : IORING_OP_WRITE;
+                    sqe.fd = t_operation->fd;
+                    sqe.addr = reinterpret_cast<uint64_t>(t_operation->buffer);
+                    // Larger requests become a short transfer, as they would with read().
+                    sqe.len = static_cast<uint32_t>(std::min<std::size_t>(t_operation->size, INT_MAX));
+                    sqe.off = static_cast<uint64_t>(t_operation->offset);
+                }
+                if (t_operation)
+                {
+                    m_inFlight.insert(t_operation);
+                }
+                error = EnterSqe();
+            }
+            if (error != 0 && t_operation)
+            {
+                m_inFlight.erase(t_operation);
+            }
+        }
+        if (error != 0 && t_operation)
+        {
+            t_operation->result = -error;
+            Complete(std::unique_ptr<Operation>(t_operation));
+        }
+    }
+
+    void RunRing()
+    {
+        while (!m_stopping.load())
+        {
+            RingEnter(m_ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+
+            unsigned head = *m_cqHead;
+            const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+                Operation* operation = reinterpret_cast<Operation*>(cqe.user_data);
+                const long result = cqe.res;
+                __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+                if (operation)
+                {
+                    Reap(operation, result);
+                }
+            }
+        }
+    }
+
+    void Reap(Operation* t_operation, long t_result)
+    {
+        // A descriptor opened with O_NONBLOCK may answer EAGAIN; then poll it and
+        // try again once it is ready. Until then the operation stays in
+        // m_inFlight, so that Cancel() still finds it.
+        bool retry;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            retry = t_operation->IsTransfer() && (t_operation->polling ? t_result >= 0 : t_result == -EAGAIN);
+            if (!retry)
+            {
+                m_inFlight.erase(t_operation);
+            }
+        }
+        if (retry)
+        {
+            t_operation->polling = !t_operation->polling;
+            Submit(t_operation);
+            return;
+        }
+        // A poll reports the events that happened; the future only needs to know it is over.
+        t_operation->result = t_operation->IsTransfer() || t_result < 0 ? t_result : 0;
+        Complete(std::unique_ptr<Operation>(t_operation));
+    }
+
+private:
+    const sink_type m_sink;
+    IoBackend m_backend = IoBackend::Epoll;
+    std::atomic_bool m_stopping{false};
+    std::mutex m_mutex;
+
+    int m_epoll = -1;
+    int m_wakeup = -1;
+    std::unordered_map<int, Interest> m_interest;
+
+    int m_ringFd = -1;
+    void* m_ring = nullptr;
+    std::size_t m_ringSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    unsigned m_sqEntries = 0;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned* m_sqArray = nullptr;
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+    std::unordered_set<Operation*> m_inFlight;
+
+    std::thread m_thread;
+};
+
+#endif //__linux__
+
+#endif //THREAD_POOLS_IO_REACTOR_H
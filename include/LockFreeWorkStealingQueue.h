@@ -0,0 +1,239 @@
+#ifndef THREAD_POOLS_LOCK_FREE_WORK_STEALING_QUEUE_H
+#define THREAD_POOLS_LOCK_FREE_WORK_STEALING_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <iterator>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "FreeList.h"
+
+// Chase-Lev work-stealing deque with the memory orderings from
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al.).
+// The owner pushes and pops at the bottom, thieves take from the top with a CAS.
+// Slots keep pointers to the elements, so a thief that loses the race never
+// touches a half-moved object. The element blocks are recycled through a
+// thread-local free list, so a steady flow of tasks does not hit the allocator.
+template<typename T>
+class LockFreeWorkStealingQueue
+{
+    class Buffer
+    {
+    public:
+        explicit Buffer(int64_t t_capacity)
+                :
+                m_capacity(t_capacity),
+                m_mask(t_capacity - 1),
+                m_slots(new std::atomic<T*>[t_capacity])
+        {}
+
+        int64_t Capacity() const
+        {
+            return m_capacity;
+        }
+
+        T* Load(int64_t t_index) const
+        {
+            return m_slots[t_index & m_mask].load(std::memory_order_relaxed);
+        }
+
+        void Store(int64_t t_index, T* t_item)
+        {
+            m_slots[t_index & m_mask].store(t_item, std::memory_order_relaxed);
+        }
+
+        Buffer* Grow(int64_t t_top, int64_t t_bottom, int64_t t_minCapacity) const
+        {
+            int64_t capacity = m_capacity * 2;
+            while (capacity < t_minCapacity)
+            {
+                capacity *= 2;
+            }
+
+            auto* buffer = new Buffer(capacity);
+            for (int64_t i = t_top; i < t_bottom; ++i)
+            {
+                buffer->Store(i, Load(i));
+            }
+            return buffer;
+        }
+
+    private:
+        int64_t m_capacity;
+        int64_t m_mask;
+        std::unique_ptr<std::atomic<T*>[]> m_slots;
+    };
+
+public:
+    explicit LockFreeWorkStealingQueue(int64_t t_capacity = 256)
+            :
+            m_top(0),
+            m_bottom(0),
+            m_buffer(new Buffer(t_capacity))
+    {}
+
+    ~LockFreeWorkStealingQueue()
+    {
+        Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        for (int64_t i = m_top.load(std::memory_order_relaxed); i < bottom; ++i)
+        {
+            Release(buffer->Load(i));
+        }
+        delete buffer;
+    }
+
+    LockFreeWorkStealingQueue(const LockFreeWorkStealingQueue&) = delete;
+    LockFreeWorkStealingQueue& operator=(const LockFreeWorkStealingQueue&) = delete;
+    LockFreeWorkStealingQueue(LockFreeWorkStealingQueue&&) = delete;
+    LockFreeWorkStealingQueue& operator=(LockFreeWorkStealingQueue&&) = delete;
+
+    // Owner only.
+    void Enque(T data)
+    {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const int64_t top = m_top.load(std::memory_order_acquire);
+        Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+
+        if (bottom - top > buffer->Capacity() - 1)
+        {
+            // Thieves may still read the old buffer, so it lives until the queue dies.
+            m_retired.emplace_back(buffer);
+            buffer = buffer->Grow(top, bottom, 0);
+            m_buffer.store(buffer, std::memory_order_release);
+        }
+
+        buffer->Store(bottom, ::new (node_cache::Allocate()) T(std::move(data)));
+        // A release store instead of the paper's release fence: the same ordering
+        // for the thieves' acquire load of m_bottom, and ThreadSanitizer sees it.
+        m_bottom.store(bottom + 1, std::memory_order_release);
+    }
+
+    // Owner only. Publishes the whole range with a single store to m_bottom.
+    template<typename Iterator>
+    void EnqueBulk(Iterator first, Iterator last)
+    {
+        const int64_t count = std::distance(first, last);
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const int64_t top = m_top.load(std::memory_order_acquire);
+        Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+
+        if (bottom - top + count > buffer->Capacity())
+        {
+            m_retired.emplace_back(buffer);
+            buffer = buffer->Grow(top, bottom, bottom - top + count);
+            m_buffer.store(buffer, std::memory_order_release);
+        }
+
+        for (int64_t i = bottom; first != last; ++first, ++i)
+        {
+            buffer->Store(i, ::new (node_cache::Allocate()) T(std::move(*first)));
+        }
+        m_bottom.store(bottom + count, std::memory_order_release);
+    }
+
+    // Owner only.
+    bool TryDeque(T& data)
+    {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom)
+        {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        T* item = buffer->Load(bottom);
+        if (top == bottom)
+        {
+            // Last element: race against the thieves for it.
+            const bool won = m_top.compare_exchange_strong(top, top + 1,
+                                                           std::memory_order_seq_cst,
+                                                           std::memory_order_relaxed);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            if (!won)
+            {
+                return false;
+            }
+        }
+
+        data = std::move(*item);
+        Release(item);
+        return true;
+    }
+
+    bool TrySteal(T& data)
+    {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom)
+        {
+            return false;
+        }
+
+        Buffer* buffer = m_buffer.load(std::memory_order_acquire);
+        T* item = buffer->Load(top);
+        if (!m_top.compare_exchange_strong(top, top + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        data = std::move(*item);
+        Release(item);
+        return true;
+    }
+
+    // Takes up to half of the elements, at most t_max: the oldest goes to data,
+    // the others are appended to t_rest in queue order. A thief can only claim
+    // the top element safely, since claiming a range could race with the owner
+    // popping inside it, so this is a run of TrySteal()s that stops when the
+    // victim would be left with fewer than the thief took. Returns how many
+    // were taken.
+    template<typename Container>
+    std::size_t TryStealHalf(T& data, Container& t_rest, std::size_t t_max)
+    {
+        if (!TrySteal(data))
+        {
+            return 0;
+        }
+
+        std::size_t count = 1;
+        T item;
+        while (count < t_max &&
+               m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed) > static_cast<int64_t>(count) &&
+               TrySteal(item))
+        {
+            t_rest.push_back(std::move(item));
+            ++count;
+        }
+        return count;
+    }
+
+private:
+    typedef ThreadLocalFreeList<T> node_cache;
+
+    static void Release(T* t_item)
+    {
+        t_item->~T();
+        node_cache::Deallocate(t_item);
+    }
+
+private:
+    // Thieves hammer m_top while the owner keeps writing m_bottom.
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    std::atomic<Buffer*> m_buffer;
+    std::vector<std::unique_ptr<Buffer>> m_retired;
+};
+
+#endif //THREAD_POOLS_LOCK_FREE_WORK_STEALING_QUEUE_H
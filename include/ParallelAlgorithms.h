@@ -0,0 +1,208 @@
+#ifndef THREAD_POOLS_PARALLEL_ALGORITHMS_H
+#define THREAD_POOLS_PARALLEL_ALGORITHMS_H
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+#include "CompletionLatch.h"
+#include "FirstException.h"
+
+// Data-parallel loops on top of StaticThreadPoolWithWorkingStealing (any pool
+// with Post(), IsWorkerThread(), RunPendingTask() and ThreadCount() will do).
+//
+// The range is cut into chunks of grainSize elements. A task that owns several
+// chunks posts the right half to its worker's local queue and goes on with the
+// left half, so an idle worker always steals the biggest piece that is left and
+// every worker ends up with O(log n) tasks. A grainSize of 0 picks one that gives
+// about eight chunks per worker. ParallelReduce combines the per-chunk results
+// from left to right, so the result does not depend on scheduling.
+template<typename Index>
+class BlockedRange
+{
+public:
+    BlockedRange(Index t_begin, Index t_end)
+            :
+            m_begin(t_begin),
+            m_end(t_end)
+    {}
+
+    Index begin() const
+    {
+        return m_begin;
+    }
+
+    Index end() const
+    {
+        return m_end;
+    }
+
+    std::size_t size() const
+    {
+        return m_end > m_begin ? static_cast<std::size_t>(m_end - m_begin) : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+private:
+    Index m_begin;
+    Index m_end;
+};
+
+namespace detail
+{
+    // One per chunk of a ParallelReduce, so that neighbouring chunks written by
+    // different workers do not share a cache line (or, for bool, a word).
+    template<typename T>
+    struct alignas(64) PaddedPartial
+    {
+        T value;
+    };
+
+    template<typename ThreadPool, typename Index>
+    class ChunkedRange
+    {
+    public:
+        ChunkedRange(const ThreadPool& t_pool, const BlockedRange<Index>& t_range, std::size_t t_grainSize)
+                :
+                m_range(t_range),
+                m_grainSize(t_grainSize != 0 ? t_grainSize : AutoGrainSize(t_pool, t_range))
+        {}
+
+        std::size_t ChunkCount() const
+        {
+            return (m_range.size() + m_grainSize - 1) / m_grainSize;
+        }
+
+        BlockedRange<Index> Chunk(std::size_t t_chunk) const
+        {
+            const std::size_t first = t_chunk * m_grainSize;
+            const std::size_t last = first + m_grainSize < m_range.size() ? first + m_grainSize : m_range.size();
+            return BlockedRange<Index>(static_cast<Index>(m_range.begin() + first),
+                                       static_cast<Index>(m_range.begin() + last));
+        }
+
+    private:
+        static std::size_t AutoGrainSize(const ThreadPool& t_pool, const BlockedRange<Index>& t_range)
+        {
+            const std::size_t chunks = t_pool.ThreadCount() * 8;
+            const std::size_t grainSize = chunks != 0 ? t_range.size() / chunks : t_range.size();
+            return grainSize != 0 ? grainSize : 1;
+        }
+
+    private:
+        BlockedRange<Index> m_range;
+        std::size_t m_grainSize;
+    };
+
+    // Runs t_leaf(chunk) for every chunk in [t_first, t_last), handing the right
+    // halves to the pool on the way down.
+    template<typename ThreadPool, typename LeafFunction>
+    void SplitChunks(ThreadPool& t_pool, std::size_t t_first, std::size_t t_last, LeafFunction& t_leaf)
+    {
+        while (t_last - t_first > 1)
+        {
+            const std::size_t middle = t_first + (t_last - t_first) / 2;
+            t_pool.Post([&t_pool, middle, t_last, &t_leaf]()
+            {
+                SplitChunks(t_pool, middle, t_last, t_leaf);
+            });
+            t_last = middle;
+        }
+        t_leaf(t_first);
+    }
+
+    template<typename ThreadPool, typename LeafFunction>
+    void RunChunks(ThreadPool& t_pool, std::size_t t_chunkCount, LeafFunction& t_leaf, CompletionLatch& t_latch)
+    {
+        if (t_chunkCount == 0)
+        {
+            return;
+        }
+
+        if (t_pool.IsWorkerThread())
+        {
+            SplitChunks(t_pool, 0, t_chunkCount, t_leaf);
+        }
+        else
+        {
+            t_pool.Post([&t_pool, t_chunkCount, &t_leaf]()
+            {
+                SplitChunks(t_pool, 0, t_chunkCount, t_leaf);
+            });
+        }
+        t_latch.Wait(t_pool);
+    }
+}
+
+template<typename ThreadPool, typename Index, typename Body>
+void ParallelFor(ThreadPool& t_pool, const BlockedRange<Index>& t_range, std::size_t t_grainSize, Body t_body)
+{
+    const detail::ChunkedRange<ThreadPool, Index> chunks(t_pool, t_range, t_grainSize);
+    const std::size_t chunkCount = t_range.empty() ? 0 : chunks.ChunkCount();
+    CompletionLatch latch(chunkCount);
+    FirstException failure;
+
+    auto leaf = [&](std::size_t t_chunk)
+    {
+        try
+        {
+            t_body(chunks.Chunk(t_chunk));
+        }
+        catch (...)
+        {
+            failure.Capture();
+        }
+        latch.CountDown();
+    };
+
+    detail::RunChunks(t_pool, chunkCount, leaf, latch);
+    failure.RethrowIfAny();
+}
+
+template<typename ThreadPool, typename Index, typename Body>
+void ParallelFor(ThreadPool& t_pool, const BlockedRange<Index>& t_range, Body t_body)
+{
+    ParallelFor(t_pool, t_range, 0, std::move(t_body));
+}
+
+// t_body(subrange, identity) reduces one chunk, t_combine(left, right) merges
+// two partial results.
+template<typename ThreadPool, typename Index, typename T, typename Body, typename Combine>
+T ParallelReduce(ThreadPool& t_pool, const BlockedRange<Index>& t_range, T t_identity,
+                 Body t_body, Combine t_combine, std::size_t t_grainSize = 0)
+{
+    const detail::ChunkedRange<ThreadPool, Index> chunks(t_pool, t_range, t_grainSize);
+    const std::size_t chunkCount = t_range.empty() ? 0 : chunks.ChunkCount();
+    std::vector<detail::PaddedPartial<T>> partials(chunkCount, detail::PaddedPartial<T>{t_identity});
+    CompletionLatch latch(chunkCount);
+    FirstException failure;
+
+    auto leaf = [&](std::size_t t_chunk)
+    {
+        try
+        {
+            partials[t_chunk].value = t_body(chunks.Chunk(t_chunk), t_identity);
+        }
+        catch (...)
+        {
+            failure.Capture();
+        }
+        latch.CountDown();
+    };
+
+    detail::RunChunks(t_pool, chunkCount, leaf, latch);
+    failure.RethrowIfAny();
+
+    T result = std::move(t_identity);
+    for (std::size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        result = t_combine(std::move(result), std::move(partials[chunk].value));
+    }
+    return result;
+}
+
+#endif //THREAD_POOLS_PARALLEL_ALGORITHMS_H
@@ -0,0 +1,92 @@
+#ifndef THREAD_POOLS_PRIORITY_LANES_H
+#define THREAD_POOLS_PRIORITY_LANES_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum class TaskPriority : uint8_t
+{
+    High,
+    Normal,
+    Low
+};
+
+constexpr std::size_t TaskPriorityLevels = 3;
+
+// The lanes in the order a consumer should look at them. Mostly high to low,
+// but every 4th call starts at Normal (then High) and every 16th at Low, so a
+// steady stream of high-priority tasks cannot starve the other lanes: while
+// all lanes are full they are served roughly 12:3:1. Only the 16th call puts
+// Low ahead of High.
+inline std::array<std::size_t, TaskPriorityLevels> LaneOrder()
+{
+    static thread_local uint32_t tick = 0;
+    ++tick;
+    if (tick % 16 == 0)
+    {
+        return {2, 0, 1};
+    }
+    if (tick % 4 == 0)
+    {
+        return {1, 0, 2};
+    }
+    return {0, 1, 2};
+}
+
+// One queue per priority level instead of a single heap-ordered one, so that
+// producers of different priorities never share a lock. Every lane is built
+// from the same constructor arguments and sits on its own cache line.
+template<class Queue>
+class PriorityLanes
+{
+    struct alignas(64) PaddedQueue
+    {
+        Queue queue;
+    };
+
+public:
+    template<typename... Args>
+    explicit PriorityLanes(const Args&... t_args)
+            :
+            m_lanes{{PaddedQueue{Queue(t_args...)}, PaddedQueue{Queue(t_args...)}, PaddedQueue{Queue(t_args...)}}}
+    {}
+
+    PriorityLanes(const PriorityLanes&) = delete;
+    PriorityLanes& operator=(const PriorityLanes&) = delete;
+    PriorityLanes(PriorityLanes&&) = delete;
+    PriorityLanes& operator=(PriorityLanes&&) = delete;
+
+    Queue& operator[](TaskPriority t_priority)
+    {
+        return m_lanes[static_cast<std::size_t>(t_priority)].queue;
+    }
+
+    Queue& Lane(std::size_t t_lane)
+    {
+        return m_lanes[t_lane].queue;
+    }
+
+    const Queue& Lane(std::size_t t_lane) const
+    {
+        return m_lanes[t_lane].queue;
+    }
+
+    template<typename T>
+    bool TryDeque(T& val)
+    {
+        for (std::size_t lane : LaneOrder())
+        {
+            if (m_lanes[lane].queue.TryDeque(val))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::array<PaddedQueue, TaskPriorityLevels> m_lanes;
+};
+
+#endif //THREAD_POOLS_PRIORITY_LANES_H
@@ -0,0 +1,351 @@
+#ifndef THREAD_POOLS_READ_OPTIMIZED_MAP_H
+#define THREAD_POOLS_READ_OPTIMIZED_MAP_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <optional>
+#include <functional>
+
+#include "EpochReclamation.h"
+
+// Hash map for read-mostly data. Lookups take no lock at all: they walk the
+// bucket chain through atomic pointers inside an EpochDomain::Guard and only
+// write their own epoch record. Writers serialize per stripe with a mutex and
+// never change a published node; an update links a new node in place of the
+// old one and retires the old one, so every write becomes visible with a
+// single release store. Growing copies the table under all stripes; readers
+// carry on in the old table until they leave their guard.
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class ReadOptimizedMap
+{
+    struct Node
+    {
+        Node(std::size_t t_hash, Key t_key, Value t_value, Node* t_next)
+                :
+                hash(t_hash),
+                key(std::move(t_key)),
+                value(std::move(t_value)),
+                next(t_next)
+        {}
+
+        const std::size_t hash;
+        const Key key;
+        const Value value;
+        std::atomic<Node*> next;
+    };
+
+    struct Table
+    {
+        explicit Table(std::size_t t_bucketCount)
+                :
+                buckets(new std::atomic<Node*>[t_bucketCount]()),
+                mask(t_bucketCount - 1)
+        {}
+
+        // Deletes the nodes as well; only for tables nobody can reach any more.
+        static void Destroy(void* t_table)
+        {
+            Table* table = static_cast<Table*>(t_table);
+            for (std::size_t i = 0; i <= table->mask; ++i)
+            {
+                Node* node = table->buckets[i].load(std::memory_order_relaxed);
+                while (node)
+                {
+                    delete std::exchange(node, node->next.load(std::memory_order_relaxed));
+                }
+            }
+            delete table;
+        }
+
+        std::unique_ptr<std::atomic<Node*>[]> buckets;
+        const std::size_t mask;
+    };
+
+    struct alignas(64) Stripe
+    {
+        std::mutex mutex;
+    };
+
+public:
+    explicit ReadOptimizedMap(std::size_t t_bucketCount = 64, std::size_t t_stripeCount = 0,
+                              const Hash& t_hash = Hash(), const KeyEqual& t_equal = KeyEqual())
+            :
+            m_stripeCount(RoundUpToPowerOfTwo(t_stripeCount != 0 ? t_stripeCount : DefaultStripeCount())),
+            m_stripes(new Stripe[m_stripeCount]),
+            m_table(new Table(RoundUpToPowerOfTwo(std::max(t_bucketCount, m_stripeCount)))),
+            m_bucketCount(m_table.load(std::memory_order_relaxed)->mask + 1),
+            m_hash(t_hash),
+            m_equal(t_equal)
+    {}
+
+    // No thread may be using the map any more.
+    ~ReadOptimizedMap()
+    {
+        Table::Destroy(m_table.load(std::memory_order_relaxed));
+    }
+
+    ReadOptimizedMap(const ReadOptimizedMap&) = delete;
+    ReadOptimizedMap& operator=(const ReadOptimizedMap&) = delete;
+    ReadOptimizedMap(ReadOptimizedMap&&) = delete;
+    ReadOptimizedMap& operator=(ReadOptimizedMap&&) = delete;
+
+    std::optional<Value> Find(const Key& t_key) const
+    {
+        const std::size_t hash = m_hash(t_key);
+        EpochDomain::Guard guard(m_epochs);
+        if (const Node* node = FindNode(*m_table.load(std::memory_order_acquire), hash, t_key))
+        {
+            return node->value;
+        }
+        return std::nullopt;
+    }
+
+    bool Contains(const Key& t_key) const
+    {
+        const std::size_t hash = m_hash(t_key);
+        EpochDomain::Guard guard(m_epochs);
+        return FindNode(*m_table.load(std::memory_order_acquire), hash, t_key) != nullptr;
+    }
+
+    // Returns true if the key was not there before.
+    bool InsertOrAssign(Key t_key, Value t_value)
+    {
+        const std::size_t hash = m_hash(t_key);
+        bool inserted;
+        {
+            std::lock_guard<std::mutex> lock(StripeFor(hash).mutex);
+            inserted = Replace(hash, std::move(t_key), std::move(t_value));
+        }
+        AfterInsert(inserted);
+        return inserted;
+    }
+
+    // Calls t_function on a copy of the current value (or a default constructed
+    // one) and publishes the result. Returns true if the key was inserted.
+    template<typename Function>
+    bool Upsert(Key t_key, Function&& t_function)
+    {
+        const std::size_t hash = m_hash(t_key);
+        bool inserted;
+        {
+            std::lock_guard<std::mutex> lock(StripeFor(hash).mutex);
+            const Node* node = FindNode(*m_table.load(std::memory_order_relaxed), hash, t_key);
+            Value value = node ? node->value : Value();
+            t_function(value);
+            inserted = Replace(hash, std::move(t_key), std::move(value));
+        }
+        AfterInsert(inserted);
+        return inserted;
+    }
+
+    // Returns the value for t_key, inserting t_factory() if it is missing. The
+    // lookup is lock-free; the factory runs under the stripe's mutex.
+    template<typename Factory>
+    Value ComputeIfAbsent(const Key& t_key, Factory&& t_factory)
+    {
+        if (std::optional<Value> value = Find(t_key))
+        {
+            return std::move(*value);
+        }
+
+        const std::size_t hash = m_hash(t_key);
+        std::optional<Value> result;
+        bool inserted = false;
+        {
+            std::lock_guard<std::mutex> lock(StripeFor(hash).mutex);
+            Table& table = *m_table.load(std::memory_order_relaxed);
+            const Node* node = FindNode(table, hash, t_key);
+            if (!node)
+            {
+                std::atomic<Node*>& head = table.buckets[hash & table.mask];
+                Node* created = new Node(hash, t_key, t_factory(), head.load(std::memory_order_relaxed));
+                head.store(created, std::memory_order_release);
+                node = created;
+                inserted = true;
+            }
+            result.emplace(node->value);
+        }
+        AfterInsert(inserted);
+        return std::move(*result);
+    }
+
+    bool Erase(const Key& t_key)
+    {
+        const std::size_t hash = m_hash(t_key);
+        Node* erased = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(StripeFor(hash).mutex);
+            Table& table = *m_table.load(std::memory_order_relaxed);
+            std::atomic<Node*>* link = &table.buckets[hash & table.mask];
+            for (Node* node = link->load(std::memory_order_relaxed); node; node = link->load(std::memory_order_relaxed))
+            {
+                if (node->hash == hash && m_equal(node->key, t_key))
+                {
+                    link->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+                    erased = node;
+                    break;
+                }
+                link = &node->next;
+            }
+        }
+
+        if (!erased)
+        {
+            return false;
+        }
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+        m_epochs.Retire(erased);
+        return true;
+    }
+
+    std::size_t Size() const
+    {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+    // May be called while other threads use the map; they see the new value
+    // from their next insert on.
+    void SetMaxLoadFactor(float t_maxLoadFactor)
+    {
+        m_maxLoadFactor.store(t_maxLoadFactor, std::memory_order_relaxed);
+    }
+
+private:
+    Stripe& StripeFor(std::size_t t_hash)
+    {
+        return m_stripes[t_hash & (m_stripeCount - 1)];
+    }
+
+    const Node* FindNode(const Table& t_table, std::size_t t_hash, const Key& t_key) const
+    {
+        for (const Node* node = t_table.buckets[t_hash & t_table.mask].load(std::memory_order_acquire);
+             node; node = node->next.load(std::memory_order_acquire))
+        {
+            if (node->hash == t_hash && m_equal(node->key, t_key))
+            {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    // Links a node with the new value in place of the old one, if any. Caller
+    // holds the key's stripe.
+    bool Replace(std::size_t t_hash, Key t_key, Value t_value)
+    {
+        Table& table = *m_table.load(std::memory_order_relaxed);
+        std::atomic<Node*>& head = table.buckets[t_hash & table.mask];
+        std::atomic<Node*>* link = &head;
+        for (Node* node = link->load(std::memory_order_relaxed); node; node = link->load(std::memory_order_relaxed))
+        {
+            if (node->hash == t_hash && m_equal(node->key, t_key))
+            {
+                Node* replacement = new Node(t_hash, std::move(t_key), std::move(t_value),
+                                             node->next.load(std::memory_order_relaxed));
+                link->store(replacement, std::memory_order_release);
+                m_epochs.Retire(node);
+                return false;
+            }
+            link = &node->next;
+        }
+
+        head.store(new Node(t_hash, std::move(t_key), std::move(t_value), head.load(std::memory_order_relaxed)),
+                   std::memory_order_release);
+        return true;
+    }
+
+    void AfterInsert(bool t_inserted)
+    {
+        if (!t_inserted)
+        {
+            return;
+        }
+
+        const std::size_t size = m_size.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (size > m_bucketCount.load(std::memory_order_relaxed) * m_maxLoadFactor.load(std::memory_order_relaxed))
+        {
+            Grow();
+        }
+    }
+
+    void Grow()
+    {
+        for (std::size_t i = 0; i < m_stripeCount; ++i)
+        {
+            m_stripes[i].mutex.lock();
+        }
+
+        Table* old = m_table.load(std::memory_order_relaxed);
+        const std::size_t bucketCount = (old->mask + 1) * 2;
+        if (m_size.load(std::memory_order_relaxed) > (old->mask + 1) * m_maxLoadFactor.load(std::memory_order_relaxed))
+        {
+            // Readers may still be walking the old chains, so the nodes are copied.
+            Table* table = new Table(bucketCount);
+            for (std::size_t i = 0; i <= old->mask; ++i)
+            {
+                for (Node* node = old->buckets[i].load(std::memory_order_relaxed); node;
+                     node = node->next.load(std::memory_order_relaxed))
+                {
+                    std::atomic<Node*>& head = table->buckets[node->hash & table->mask];
+                    head.store(new Node(node->hash, node->key, node->value, head.load(std::memory_order_relaxed)),
+                               std::memory_order_relaxed);
+                }
+            }
+            m_table.store(table, std::memory_order_release);
+            m_bucketCount.store(bucketCount, std::memory_order_relaxed);
+        }
+        else
+        {
+            old = nullptr;
+        }
+
+        for (std::size_t i = m_stripeCount; i > 0; --i)
+        {
+            m_stripes[i - 1].mutex.unlock();
+        }
+
+        if (old)
+        {
+            m_epochs.Retire(old, &Table::Destroy);
+        }
+    }
+
+    static std::size_t DefaultStripeCount()
+    {
+        const std::size_t threads = std::thread::hardware_concurrency();
+        return std::max<std::size_t>(16, threads * 8);
+    }
+
+    static std::size_t RoundUpToPowerOfTwo(std::size_t t_value)
+    {
+        std::size_t result = 1;
+        while (result < t_value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+private:
+    const std::size_t m_stripeCount;
+    std::unique_ptr<Stripe[]> m_stripes;
+    std::atomic<Table*> m_table;
+    std::atomic<std::size_t> m_bucketCount;
+    std::atomic<std::size_t> m_size{0};
+    mutable EpochDomain m_epochs;
+    std::atomic<float> m_maxLoadFactor{1.0f};
+    Hash m_hash;
+    KeyEqual m_equal;
+};
+
+#endif //THREAD_POOLS_READ_OPTIMIZED_MAP_H
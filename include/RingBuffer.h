@@ -0,0 +1,143 @@
+#ifndef THREAD_POOLS_RING_BUFFER_H
+#define THREAD_POOLS_RING_BUFFER_H
+
+#include <new>
+#include <memory>
+#include <utility>
+#include <cstddef>
+
+// Growable circular buffer used instead of std::deque inside the queues.
+// std::deque allocates and frees a block every few elements as tasks flow
+// through it; this one only allocates when it has to grow. Not thread safe.
+template<typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(std::size_t t_capacity = 64)
+            :
+            m_capacity(RoundUpToPowerOfTwo(t_capacity)),
+            m_slots(Allocate(m_capacity))
+    {}
+
+    ~RingBuffer()
+    {
+        Clear();
+        Deallocate(m_slots);
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+    RingBuffer(RingBuffer&&) = delete;
+    RingBuffer& operator=(RingBuffer&&) = delete;
+
+    bool Empty() const
+    {
+        return m_size == 0;
+    }
+
+    std::size_t Size() const
+    {
+        return m_size;
+    }
+
+    T& Front()
+    {
+        return m_slots[m_head];
+    }
+
+    T& Back()
+    {
+        return m_slots[Index(m_size - 1)];
+    }
+
+    void PushBack(T&& t_value)
+    {
+        GrowIfFull();
+        ::new (static_cast<void*>(m_slots + Index(m_size))) T(std::move(t_value));
+        ++m_size;
+    }
+
+    void PushFront(T&& t_value)
+    {
+        GrowIfFull();
+        m_head = (m_head + m_capacity - 1) & (m_capacity - 1);
+        ::new (static_cast<void*>(m_slots + m_head)) T(std::move(t_value));
+        ++m_size;
+    }
+
+    void PopFront()
+    {
+        m_slots[m_head].~T();
+        m_head = Index(1);
+        --m_size;
+    }
+
+    void PopBack()
+    {
+        m_slots[Index(m_size - 1)].~T();
+        --m_size;
+    }
+
+    void Clear()
+    {
+        while (!Empty())
+        {
+            PopFront();
+        }
+    }
+
+private:
+    std::size_t Index(std::size_t t_offset) const
+    {
+        return (m_head + t_offset) & (m_capacity - 1);
+    }
+
+    void GrowIfFull()
+    {
+        if (m_size < m_capacity)
+        {
+            return;
+        }
+
+        T* slots = Allocate(m_capacity * 2);
+        for (std::size_t i = 0; i < m_size; ++i)
+        {
+            T& value = m_slots[Index(i)];
+            ::new (static_cast<void*>(slots + i)) T(std::move(value));
+            value.~T();
+        }
+
+        Deallocate(m_slots);
+        m_slots = slots;
+        m_capacity *= 2;
+        m_head = 0;
+    }
+
+    static std::size_t RoundUpToPowerOfTwo(std::size_t t_value)
+    {
+        std::size_t result = 1;
+        while (result < t_value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    static T* Allocate(std::size_t t_capacity)
+    {
+        return std::allocator<T>().allocate(t_capacity);
+    }
+
+    void Deallocate(T* t_slots)
+    {
+        std::allocator<T>().deallocate(t_slots, m_capacity);
+    }
+
+private:
+    std::size_t m_capacity;
+    std::size_t m_head = 0;
+    std::size_t m_size = 0;
+    T* m_slots;
+};
+
+#endif //THREAD_POOLS_RING_BUFFER_H
@@ -1,43 +1,80 @@
 #ifndef STATIC_THREADPOOL_H
 #define STATIC_THREADPOOL_H
 
-#include "ThreadSafeQueue.h"
+#include "GlobalQueue.h"
+#include "BoundedQueue.h"
 #include "JoinThreads.h"
 #include "FunctionWrapper.h"
+#include "EventCount.h"
+#include "IdlePolicy.h"
+#include "ThreadPoolBase.h"
+#include "ThreadPlacement.h"
+#include "PriorityLanes.h"
+#include "TimingWheel.h"
+#include "WorkerStats.h"
 
 #include <atomic>
 #include <thread>
 #include <future>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
 
-class StaticThreadPool
+namespace detail
+{
+    // Whether Queue can wait for room, like BoundedQueue::Enque(T&&, timeout).
+    template<typename Queue, typename = void>
+    struct HasTimedEnque : std::false_type
+    {};
+
+    template<typename Queue>
+    struct HasTimedEnque<Queue, std::void_t<decltype(std::declval<Queue&>().Enque(
+            std::declval<FunctionWrapper&&>(), std::chrono::milliseconds(0)))>> : std::true_type
+    {};
+}
+
+// GlobalQueue is the queue all workers share, one per priority level:
+// ThreadSafeQueue and FlatCombiningQueue grow without limit (DefaultGlobalQueue
+// picks one of them), BoundedQueue has a fixed capacity and pushes back on
+// producers.
+template<typename GlobalQueue>
+class BasicStaticThreadPool : public ThreadPoolBase<BasicStaticThreadPool<GlobalQueue>>,
+                              public TimerScheduling<BasicStaticThreadPool<GlobalQueue>>
 {
 public:
-    StaticThreadPool(const StaticThreadPool&) = delete;
-    StaticThreadPool& operator=(const StaticThreadPool&) = delete;
-    StaticThreadPool(StaticThreadPool&&) = delete;
-    StaticThreadPool& operator=(StaticThreadPool&&) = delete;
+    BasicStaticThreadPool(const BasicStaticThreadPool&) = delete;
+    BasicStaticThreadPool& operator=(const BasicStaticThreadPool&) = delete;
+    BasicStaticThreadPool(BasicStaticThreadPool&&) = delete;
+    BasicStaticThreadPool& operator=(BasicStaticThreadPool&&) = delete;
+
+    explicit BasicStaticThreadPool(const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : BasicStaticThreadPool(ThreadPlacement(), t_idlePolicy)
+    {}
 
-    StaticThreadPool()
-        : m_done(false), m_joiner(m_threads)
+    explicit BasicStaticThreadPool(const ThreadPlacement& t_placement, const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : m_done(false), m_idlePolicy(t_idlePolicy), m_joiner(m_threads)
     {
-        const uint16_t threadCount = std::thread::hardware_concurrency();
-        try
-        {
-            for (uint16_t i = 0; i < threadCount; ++i)
-            {
-                m_threads.emplace_back(&StaticThreadPool::WorkerThread, this);
-            }
-        }
-        catch (...)
-        {
-            m_done = true;
-            throw;
-        }
+        StartWorkers(t_placement);
     }
 
-    ~StaticThreadPool()
+    // Only for a bounded GlobalQueue. Every priority lane gets this capacity.
+    explicit BasicStaticThreadPool(std::size_t t_queueCapacity, const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : BasicStaticThreadPool(t_queueCapacity, ThreadPlacement(), t_idlePolicy)
+    {}
+
+    BasicStaticThreadPool(std::size_t t_queueCapacity, const ThreadPlacement& t_placement,
+                          const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : m_done(false), m_idlePolicy(t_idlePolicy), m_work_queue(t_queueCapacity), m_joiner(m_threads)
+    {
+        StartWorkers(t_placement);
+    }
+
+    ~BasicStaticThreadPool()
     {
         m_done = true;
+        m_wakeup.NotifyAll();
     }
 
     template<typename FunctionType>
@@ -47,32 +84,216 @@ public:
         typedef typename std::result_of<FunctionType()>::type resultType;
         std::packaged_task<resultType()> task(std::move(function));
         std::future<resultType> result(task.get_future());
-        m_work_queue.Enque(std::move(task));
+        Post(std::move(task));
         return result;
     }
 
+    // Tasks of a higher priority are started first; see LaneOrder() for how the
+    // lower lanes still get their turn.
+    template<typename FunctionType>
+    std::future<typename std::result_of<FunctionType()>::type>
+    Submit(TaskPriority t_priority, FunctionType function)
+    {
+        typedef typename std::result_of<FunctionType()>::type resultType;
+        std::packaged_task<resultType()> task(std::move(function));
+        std::future<resultType> result(task.get_future());
+        Post(t_priority, std::move(task));
+        return result;
+    }
+
+    // Fire and forget: no future and no shared state. With a bounded queue this
+    // blocks while the queue is full, so tasks of this pool should not Post()
+    // into it; they can use TryPost() instead.
+    template<typename FunctionType>
+    void Post(FunctionType function)
+    {
+        Post(TaskPriority::Normal, std::move(function));
+    }
+
+    template<typename FunctionType>
+    void Post(TaskPriority t_priority, FunctionType function)
+    {
+        m_work_queue[t_priority].Enque(FunctionWrapper(std::move(function)));
+        m_wakeup.NotifyOne();
+    }
+
+    // Returns false instead of waiting if the queue is full.
+    template<typename FunctionType>
+    bool TryPost(FunctionType function)
+    {
+        FunctionWrapper task(std::move(function));
+        return TryEnque(task);
+    }
+
+    // Waits up to t_timeout for room in a bounded queue.
+    template<typename FunctionType, typename Rep, typename Period>
+    bool TryPost(FunctionType function, const std::chrono::duration<Rep, Period>& t_timeout)
+    {
+        FunctionWrapper task(std::move(function));
+        return TryEnque(task, t_timeout);
+    }
+
+    // The returned future is not valid() if the task was rejected.
+    template<typename FunctionType>
+    std::future<typename std::result_of<FunctionType()>::type>
+    TrySubmit(FunctionType function)
+    {
+        typedef typename std::result_of<FunctionType()>::type resultType;
+        std::packaged_task<resultType()> task(std::move(function));
+        std::future<resultType> result(task.get_future());
+        FunctionWrapper wrapper(std::move(task));
+        return TryEnque(wrapper) ? std::move(result) : std::future<resultType>();
+    }
+
+    template<typename FunctionType, typename Rep, typename Period>
+    std::future<typename std::result_of<FunctionType()>::type>
+    TrySubmit(FunctionType function, const std::chrono::duration<Rep, Period>& t_timeout)
+    {
+        typedef typename std::result_of<FunctionType()>::type resultType;
+        std::packaged_task<resultType()> task(std::move(function));
+        std::future<resultType> result(task.get_future());
+        FunctionWrapper wrapper(std::move(task));
+        return TryEnque(wrapper, t_timeout) ? std::move(result) : std::future<resultType>();
+    }
+
+    std::size_t ThreadCount() const
+    {
+        return m_threads.size();
+    }
+
+    // Per-worker counters and latency histograms; all zero unless the pool is
+    // built with THREAD_POOL_STATS.
+    PoolStats Stats() const
+    {
+        PoolStats stats;
+        for (std::size_t i = 0; i < m_threads.size(); ++i)
+        {
+            stats.workers.push_back(m_stats[i].Snapshot());
+        }
+        for (std::size_t lane = 0; lane < TaskPriorityLevels; ++lane)
+        {
+            stats.queuedTasks += m_work_queue.Lane(lane).Size();
+        }
+        return stats;
+    }
+
 private:
-    void WorkerThread()
+    friend class ThreadPoolBase<BasicStaticThreadPool>;
+    friend class TimerScheduling<BasicStaticThreadPool>;
+
+    void StartWorkers(const ThreadPlacement& t_placement)
     {
-        while(!m_done)
+        try
         {
-            FunctionWrapper task;
-            if (m_work_queue.TryDeque(task))
+            const std::vector<WorkerSlot> slots = PlanWorkers(t_placement);
+            m_stats = std::make_unique<WorkerStats[]>(slots.size());
+            for (std::size_t i = 0; i < slots.size(); ++i)
             {
-                task();
+                m_threads.emplace_back(&BasicStaticThreadPool::WorkerThread, this, slots[i].cpu, &m_stats[i]);
             }
-            else
+        }
+        catch (...)
+        {
+            m_done = true;
+            m_wakeup.NotifyAll();
+            throw;
+        }
+    }
+
+    bool TryEnque(FunctionWrapper& t_task)
+    {
+        if (!m_work_queue[TaskPriority::Normal].TryEnque(std::move(t_task)))
+        {
+            return false;
+        }
+        m_wakeup.NotifyOne();
+        return true;
+    }
+
+    // A queue that cannot wait for room is never full, so the timeout only
+    // matters on a bounded one.
+    template<typename Rep, typename Period>
+    bool TryEnque(FunctionWrapper& t_task, const std::chrono::duration<Rep, Period>& t_timeout)
+    {
+        GlobalQueue& queue = m_work_queue[TaskPriority::Normal];
+        bool enqueued = false;
+        if constexpr (detail::HasTimedEnque<GlobalQueue>::value)
+        {
+            enqueued = queue.Enque(std::move(t_task), t_timeout);
+        }
+        else
+        {
+            enqueued = queue.TryEnque(std::move(t_task));
+        }
+        if (!enqueued)
+        {
+            return false;
+        }
+        m_wakeup.NotifyOne();
+        return true;
+    }
+
+    // Expired timers come in here. A full bounded queue must not keep the
+    // timer thread from stopping when the pool goes away.
+    void InjectTimer(FunctionWrapper&& t_task)
+    {
+        while (!TryEnque(t_task, std::chrono::milliseconds(10)))
+        {
+            if (m_done)
             {
-                std::this_thread::yield();
+                return;
             }
         }
     }
 
+    // Whatever does not fit into a bounded queue goes in one by one, after the
+    // workers have been woken up to make room.
+    void EnqueBatch(std::vector<FunctionWrapper>& t_tasks)
+    {
+        GlobalQueue& queue = m_work_queue[TaskPriority::Normal];
+        auto next = queue.TryEnqueBulk(t_tasks.begin(), t_tasks.end());
+        m_wakeup.NotifyMany(static_cast<std::size_t>(next - t_tasks.begin()));
+        for (; next != t_tasks.end(); ++next)
+        {
+            queue.Enque(std::move(*next));
+            m_wakeup.NotifyOne();
+        }
+    }
+
+    void WorkerThread(int t_cpu, WorkerStats* t_stats)
+    {
+        PinCurrentThread(t_cpu);
+
+        RunWorkerLoop(m_done, m_wakeup, m_idlePolicy, *t_stats, [this, t_stats]()
+        {
+            return RunPendingTask(*t_stats);
+        });
+    }
+
+    bool RunPendingTask(WorkerStats& t_stats)
+    {
+        FunctionWrapper task;
+        if (m_work_queue.TryDeque(task))
+        {
+            t_stats.GlobalPop();
+            t_stats.Run(task);
+            return true;
+        }
+        return false;
+    }
+
 private:
     std::atomic_bool m_done;
-    ThreadSafeQueue<FunctionWrapper> m_work_queue;
+    const IdlePolicy m_idlePolicy;
+    EventCount m_wakeup;
+    PriorityLanes<GlobalQueue> m_work_queue;
+    std::unique_ptr<WorkerStats[]> m_stats;
+    TimingWheel m_timers{[this](FunctionWrapper&& t_task) { InjectTimer(std::move(t_task)); }};
     std::vector<std::thread> m_threads;
     JoinThreads m_joiner;
 };
 
+typedef BasicStaticThreadPool<DefaultGlobalQueue<FunctionWrapper>> StaticThreadPool;
+typedef BasicStaticThreadPool<BoundedQueue<FunctionWrapper>> BoundedStaticThreadPool;
+
 #endif //STATIC_THREADPOOL_H
@@ -1,36 +1,82 @@
 #ifndef THREAD_POOLS_STATIC_THREAD_POOL_USING_POSIX_API_H
 #define THREAD_POOLS_STATIC_THREAD_POOL_USING_POSIX_API_H
 
+#include <atomic>
 #include <future>
+#include <memory>
 #include <vector>
-#include <unistd.h>
+#include <algorithm>
+#include <system_error>
+#include <limits.h>
+#include <sched.h>
 #include <pthread.h>
 
 #include "FunctionWrapper.h"
-#include "ThreadSafeQueue.h"
+#include "GlobalQueue.h"
+#include "FutexEventCount.h"
+#include "IdlePolicy.h"
+#include "ThreadPoolBase.h"
+#include "ThreadPlacement.h"
+#include "WorkerStats.h"
+
+// How the workers are created. A stackSize of 0 keeps the default; anything
+// smaller than PTHREAD_STACK_MIN is raised to it. schedulingPolicy and priority
+// go to pthread_attr_setschedparam(); a real-time policy such as SCHED_FIFO
+// usually needs privileges, and the constructor throws if it is refused.
+struct PosixThreadAttributes
+{
+    std::size_t stackSize = 0;
+    int schedulingPolicy = SCHED_OTHER;
+    int priority = 0;
+};
 
-class StaticThreadPoolUsingPosixApi
+// Workers are plain pthreads that park on a futex (see FutexEventCount), so a
+// Submit() to a sleeping pool costs one FUTEX_WAKE. On Linux the CPU affinity
+// is part of the thread attributes, so a pinned worker never runs anywhere
+// else, not even for its first instructions.
+class StaticThreadPoolUsingPosixApi : public ThreadPoolBase<StaticThreadPoolUsingPosixApi>
 {
+    struct WorkerStart
+    {
+        StaticThreadPoolUsingPosixApi* pool;
+        std::size_t index;
+    };
+
 public:
     StaticThreadPoolUsingPosixApi(const StaticThreadPoolUsingPosixApi&) = delete;
     StaticThreadPoolUsingPosixApi& operator=(const StaticThreadPoolUsingPosixApi&) = delete;
     StaticThreadPoolUsingPosixApi(StaticThreadPoolUsingPosixApi&&) = delete;
     StaticThreadPoolUsingPosixApi& operator=(StaticThreadPoolUsingPosixApi&&) = delete;
 
-    StaticThreadPoolUsingPosixApi()
+    explicit StaticThreadPoolUsingPosixApi(const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : StaticThreadPoolUsingPosixApi(ThreadPlacement(), t_idlePolicy)
+    {}
+
+    explicit StaticThreadPoolUsingPosixApi(const ThreadPlacement& t_placement,
+                                           const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : StaticThreadPoolUsingPosixApi(t_placement, PosixThreadAttributes(), t_idlePolicy)
+    {}
+
+    // Throws std::system_error if a thread cannot be created with t_attributes;
+    // the threads created so far are stopped first.
+    StaticThreadPoolUsingPosixApi(const ThreadPlacement& t_placement, const PosixThreadAttributes& t_attributes,
+                                  const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : m_idlePolicy(t_idlePolicy), m_slots(PlanWorkers(t_placement)),
+          m_stats(std::make_unique<WorkerStats[]>(m_slots.size()))
     {
-        uint16_t threadsCount = sysconf(_SC_NPROCESSORS_CONF);
-
-        pthread_mutex_init(&m_mutex, nullptr);
+        m_starts.reserve(m_slots.size());
+        m_threads.reserve(m_slots.size());
 
-        for (uint16_t i = 0; i < threadsCount; ++i)
+        for (std::size_t i = 0; i < m_slots.size(); ++i)
         {
-            pthread_t thread;
+            m_starts.push_back(WorkerStart{this, i});
 
-            if (pthread_create(&thread, nullptr, &StaticThreadPoolUsingPosixApi::WorkerThread, this) != 0)
+            pthread_t thread;
+            const int error = CreateThread(thread, t_attributes, m_slots[i].cpu, m_starts.back());
+            if (error != 0)
             {
                 CleanupThreads();
-                break;
+                throw std::system_error(error, std::generic_category(), "pthread_create");
             }
 
             m_threads.push_back(thread);
@@ -40,7 +86,6 @@ public:
     ~StaticThreadPoolUsingPosixApi()
     {
         CleanupThreads();
-        pthread_mutex_destroy(&m_mutex);
     }
 
     template<typename FunctionType>
@@ -50,27 +95,112 @@ public:
         typedef typename std::result_of<FunctionType()>::type resultType;
         std::packaged_task<resultType()> task(std::move(function));
         std::future<resultType> result(task.get_future());
-        m_workers.Enque(std::move(task));
+        Post(std::move(task));
         return result;
     }
 
+    // Fire and forget: no future and no shared state.
+    template<typename FunctionType>
+    void Post(FunctionType function)
+    {
+        m_workers.Enque(FunctionWrapper(std::move(function)));
+        m_wakeup.NotifyOne();
+    }
+
+    std::size_t ThreadCount() const
+    {
+        return m_threads.size();
+    }
+
+    // Per-worker counters and latency histograms; all zero unless the pool is
+    // built with THREAD_POOL_STATS.
+    PoolStats Stats() const
+    {
+        PoolStats stats;
+        for (std::size_t i = 0; i < m_threads.size(); ++i)
+        {
+            stats.workers.push_back(m_stats[i].Snapshot());
+        }
+        stats.queuedTasks = m_workers.Size();
+        return stats;
+    }
+
 private:
-    static void* WorkerThread(void* arg)
+    friend class ThreadPoolBase<StaticThreadPoolUsingPosixApi>;
+
+    void EnqueBatch(std::vector<FunctionWrapper>& t_tasks)
+    {
+        m_workers.EnqueBulk(t_tasks.begin(), t_tasks.end());
+        m_wakeup.NotifyMany(t_tasks.size());
+    }
+
+    static int CreateThread(pthread_t& t_thread, const PosixThreadAttributes& t_attributes, int t_cpu,
+                            WorkerStart& t_start)
     {
-        auto* pool = static_cast<StaticThreadPoolUsingPosixApi*>(arg);
+        pthread_attr_t attributes;
+        int error = pthread_attr_init(&attributes);
+        if (error != 0)
+        {
+            return error;
+        }
 
-        while (!pool->m_done)
+        if (t_attributes.stackSize != 0)
         {
-            FunctionWrapper task;
-            if (pool->m_workers.TryDeque(task))
+            error = pthread_attr_setstacksize(&attributes,
+                                              std::max<std::size_t>(t_attributes.stackSize, PTHREAD_STACK_MIN));
+        }
+        if (error == 0 && (t_attributes.schedulingPolicy != SCHED_OTHER || t_attributes.priority != 0))
+        {
+            sched_param parameters{};
+            parameters.sched_priority = t_attributes.priority;
+            error = pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED);
+            if (error == 0)
             {
-                task();
+                error = pthread_attr_setschedpolicy(&attributes, t_attributes.schedulingPolicy);
             }
-            else
+            if (error == 0)
             {
-                sched_yield();
+                error = pthread_attr_setschedparam(&attributes, &parameters);
             }
         }
+#ifdef __linux__
+        if (error == 0 && t_cpu >= 0 && t_cpu < CPU_SETSIZE)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(t_cpu, &set);
+            error = pthread_attr_setaffinity_np(&attributes, sizeof(set), &set);
+        }
+#endif //__linux__
+        if (error == 0)
+        {
+            error = pthread_create(&t_thread, &attributes, &StaticThreadPoolUsingPosixApi::WorkerThread, &t_start);
+        }
+
+        pthread_attr_destroy(&attributes);
+        return error;
+    }
+
+    static void* WorkerThread(void* arg)
+    {
+        const WorkerStart& start = *static_cast<WorkerStart*>(arg);
+        StaticThreadPoolUsingPosixApi* pool = start.pool;
+#ifndef __linux__
+        PinCurrentThread(pool->m_slots[start.index].cpu);
+#endif //__linux__
+        WorkerStats& stats = pool->m_stats[start.index];
+
+        RunWorkerLoop(pool->m_done, pool->m_wakeup, pool->m_idlePolicy, stats, [pool, &stats]()
+        {
+            FunctionWrapper task;
+            if (pool->m_workers.TryDeque(task))
+            {
+                stats.GlobalPop();
+                stats.Run(task);
+                return true;
+            }
+            return false;
+        });
 
         return nullptr;
     }
@@ -78,6 +208,7 @@ private:
     void CleanupThreads()
     {
         m_done = true;
+        m_wakeup.NotifyAll();
 
         for (pthread_t thread : m_threads)
         {
@@ -88,10 +219,14 @@ private:
     }
 
 private:
-    bool m_done = false;
-    pthread_mutex_t m_mutex{};
+    std::atomic_bool m_done{false};
+    const IdlePolicy m_idlePolicy;
+    FutexEventCount m_wakeup;
+    const std::vector<WorkerSlot> m_slots;
+    const std::unique_ptr<WorkerStats[]> m_stats;
+    std::vector<WorkerStart> m_starts;
     std::vector<pthread_t> m_threads;
-    ThreadSafeQueue<FunctionWrapper> m_workers;
+    DefaultGlobalQueue<FunctionWrapper> m_workers;
 };
 
 #endif // THREAD_POOLS_STATIC_THREAD_POOL_USING_POSIX_API_H
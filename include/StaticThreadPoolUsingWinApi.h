@@ -3,9 +3,14 @@
 
 #include <future>
 #include <vector>
+#include <system_error>
 #include <windows.h>
 
-class StaticThreadPoolUsingWinApi
+#include "FunctionWrapper.h"
+#include "ThreadPoolBase.h"
+#include "WorkerStats.h"
+
+class StaticThreadPoolUsingWinApi : public ThreadPoolBase<StaticThreadPoolUsingWinApi>
 {
 public:
     StaticThreadPoolUsingWinApi(const StaticThreadPoolUsingWinApi&) = delete;
@@ -47,7 +52,44 @@ public:
         return result;
     }
 
+    // Fire and forget: no future, no shared state and no work object to keep around.
+    template<typename FunctionType>
+    void Post(FunctionType function)
+    {
+        auto* task = new FunctionWrapper(std::move(function));
+        if (!TrySubmitThreadpoolCallback(PostCallback, task, nullptr))
+        {
+            delete task;
+            throw std::system_error(static_cast<int>(GetLastError()), std::system_category());
+        }
+    }
+
+    // The tasks run on threads owned by the system pool, so there is nothing
+    // to report.
+    PoolStats Stats() const
+    {
+        return PoolStats();
+    }
+
 private:
+    friend class ThreadPoolBase<StaticThreadPoolUsingWinApi>;
+
+    // The system pool has no bulk submission, so this is a plain loop.
+    void EnqueBatch(std::vector<FunctionWrapper>& t_tasks)
+    {
+        for (auto& task : t_tasks)
+        {
+            Post(std::move(task));
+        }
+    }
+
+    static void CALLBACK PostCallback(PTP_CALLBACK_INSTANCE, PVOID Context)
+    {
+        auto* task = static_cast<FunctionWrapper*>(Context);
+        (*task)();
+        delete task;
+    }
+
     template<typename ResultType>
     static void CALLBACK ThreadPoolWorkCallback(PTP_CALLBACK_INSTANCE, PVOID Context, PTP_WORK)
     {
@@ -2,38 +2,60 @@
 #define THREAD_POOL_AND_THREADSAFE_MAP_STATIC_THREAD_POOL_WITH_LOCAL_QUEUE_H
 
 #include <memory>
-#include <queue>
 #include <future>
 #include <thread>
 #include <atomic>
 #include <vector>
+#include <chrono>
 
 #include "JoinThreads.h"
 #include "FunctionWrapper.h"
-#include "ThreadSafeQueue.h"
+#include "GlobalQueue.h"
+#include "RingBuffer.h"
+#include "EventCount.h"
+#include "IdlePolicy.h"
+#include "ThreadPoolBase.h"
+#include "CooperativeWait.h"
+#include "ThreadPlacement.h"
+#include "TimingWheel.h"
+#include "WorkerStats.h"
+#include "WorkerContext.h"
 
-class StaticThreadPoolWithLocalQueue
+class StaticThreadPoolWithLocalQueue : public ThreadPoolBase<StaticThreadPoolWithLocalQueue>,
+                                       public TimerScheduling<StaticThreadPoolWithLocalQueue>
 {
+    struct Worker
+    {
+        RingBuffer<FunctionWrapper> queue;
+        WorkerStats stats;
+    };
+
 public:
     StaticThreadPoolWithLocalQueue(const StaticThreadPoolWithLocalQueue&) = delete;
     StaticThreadPoolWithLocalQueue& operator=(const StaticThreadPoolWithLocalQueue&) = delete;
     StaticThreadPoolWithLocalQueue(StaticThreadPoolWithLocalQueue&&) = delete;
     StaticThreadPoolWithLocalQueue& operator=(StaticThreadPoolWithLocalQueue&&) = delete;
 
-    StaticThreadPoolWithLocalQueue()
-        : m_done(false), m_joiner(m_threads)
+    explicit StaticThreadPoolWithLocalQueue(const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : StaticThreadPoolWithLocalQueue(ThreadPlacement(), t_idlePolicy)
+    {}
+
+    explicit StaticThreadPoolWithLocalQueue(const ThreadPlacement& t_placement,
+                                            const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : m_done(false), m_idlePolicy(t_idlePolicy), m_slots(PlanWorkers(t_placement)),
+          m_workers(m_slots.size()), m_joiner(m_threads)
     {
-        const uint16_t threadsCount = std::thread::hardware_concurrency();
         try
         {
-            for (uint16_t i = 0; i < threadsCount; ++i)
+            for (std::size_t i = 0; i < m_slots.size(); ++i)
             {
-                m_threads.emplace_back(&StaticThreadPoolWithLocalQueue::WorkerThread, this);
+                m_threads.emplace_back(&StaticThreadPoolWithLocalQueue::WorkerThread, this, i);
             }
         }
         catch (...)
         {
             m_done = true;
+            m_wakeup.NotifyAll();
             throw;
         }
     }
@@ -41,6 +63,7 @@ public:
     ~StaticThreadPoolWithLocalQueue()
     {
         m_done = true;
+        m_wakeup.NotifyAll();
     }
 
     template<typename FunctionType>
@@ -50,59 +73,134 @@ public:
         typedef typename std::result_of<FunctionType()>::type resultType;
         std::packaged_task<resultType()> task(std::move(function));
         std::future<resultType> result(task.get_future());
+        Post(std::move(task));
+        return result;
+    }
 
-        if (m_localQueue)
+    // Fire and forget: no future and no shared state.
+    template<typename FunctionType>
+    void Post(FunctionType function)
+    {
+        if (Worker* self = m_workers.Current())
         {
-            m_localQueue->push(std::move(task));
+            self->queue.PushBack(FunctionWrapper(std::move(function)));
         }
         else
         {
-            m_mainQueue.Enque(std::move(task));
+            m_mainQueue.Enque(FunctionWrapper(std::move(function)));
+            m_wakeup.NotifyOne();
         }
+    }
 
-        return result;
+    // Waits for a std::future, std::shared_future or TaskFuture. On a worker of
+    // this pool it keeps running pending tasks until the result is ready, so a
+    // task can wait for its children without blocking its thread.
+    template<typename Future>
+    void WaitFor(const Future& t_future)
+    {
+        WaitForFuture(*this, t_future);
     }
 
-private:
-    void RunPendingTask()
+    // Runs one task from the local or the pool queue; false if there was none.
+    // The local queue is served newest first: a worker that waits in WaitFor()
+    // then runs its own children first and the nesting stays as deep as the
+    // recursion itself. Tasks run by a thread outside the pool are not counted
+    // in the stats.
+    bool RunPendingTask()
     {
         FunctionWrapper task;
+        Worker* self = m_workers.Current();
 
-        if (m_localQueue && !m_localQueue->empty())
+        if (self && !self->queue.Empty())
         {
-            task = std::move(m_localQueue->front());
-            m_localQueue->pop();
-            task();
+            task = std::move(self->queue.Back());
+            self->queue.PopBack();
+            self->stats.LocalPop();
+            self->stats.Run(task);
+            return true;
         }
         else if (m_mainQueue.TryDeque(task))
         {
-            task();
+            if (self)
+            {
+                self->stats.GlobalPop();
+                self->stats.Run(task);
+            }
+            else
+            {
+                task();
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    bool IsWorkerThread() const
+    {
+        return m_workers.Current() != nullptr;
+    }
+
+    std::size_t ThreadCount() const
+    {
+        return m_threads.size();
+    }
+
+    // Per-worker counters and latency histograms, all zero unless the pool is
+    // built with THREAD_POOL_STATS. queuedTasks counts the pool queue only.
+    PoolStats Stats() const
+    {
+        PoolStats stats;
+        for (std::size_t i = 0; i < m_workers.Size(); ++i)
+        {
+            stats.workers.push_back(m_workers.IsBuilt(i) ? m_workers[i].stats.Snapshot() : WorkerStatsSnapshot());
+        }
+        stats.queuedTasks = m_mainQueue.Size();
+        return stats;
+    }
+
+private:
+    friend class ThreadPoolBase<StaticThreadPoolWithLocalQueue>;
+    friend class TimerScheduling<StaticThreadPoolWithLocalQueue>;
+
+    void EnqueBatch(std::vector<FunctionWrapper>& t_tasks)
+    {
+        if (Worker* self = m_workers.Current())
+        {
+            for (auto& task : t_tasks)
+            {
+                self->queue.PushBack(std::move(task));
+            }
         }
         else
         {
-            std::this_thread::yield();
+            m_mainQueue.EnqueBulk(t_tasks.begin(), t_tasks.end());
+            m_wakeup.NotifyMany(t_tasks.size());
         }
     }
 
-    void WorkerThread()
+    // The worker is built after pinning, so its queue lands on the worker's node.
+    void WorkerThread(std::size_t t_index)
     {
-        m_localQueue = std::make_unique<local_queue_type>();
+        PinCurrentThread(m_slots[t_index].cpu);
+        Worker& self = m_workers.Emplace(t_index);
 
-        while (!m_done)
+        RunWorkerLoop(m_done, m_wakeup, m_idlePolicy, self.stats, [this]()
         {
-            RunPendingTask();
-        }
+            return RunPendingTask();
+        });
     }
 
 private:
     std::atomic_bool m_done;
-    ThreadSafeQueue<FunctionWrapper> m_mainQueue;
-    typedef std::queue<FunctionWrapper> local_queue_type;
-    static thread_local std::unique_ptr<local_queue_type> m_localQueue;
+    const IdlePolicy m_idlePolicy;
+    EventCount m_wakeup;
+    DefaultGlobalQueue<FunctionWrapper> m_mainQueue;
+    const std::vector<WorkerSlot> m_slots;
+    WorkerContexts<Worker> m_workers;
+    TimingWheel m_timers{[this](FunctionWrapper&& t_task) { Post(std::move(t_task)); }};
     std::vector<std::thread> m_threads;
     JoinThreads m_joiner;
 };
 
-thread_local std::unique_ptr<StaticThreadPoolWithLocalQueue::local_queue_type> StaticThreadPoolWithLocalQueue::m_localQueue;
-
 #endif //THREAD_POOL_AND_THREADSAFE_MAP_STATIC_THREAD_POOL_WITH_LOCAL_QUEUE_H
@@ -1,39 +1,81 @@
 #ifndef THREAD_POOLS_STATIC_THREAD_POOL_WITH_WORK_STEALING_H
 #define THREAD_POOLS_STATIC_THREAD_POOL_WITH_WORK_STEALING_H
 
+#include <array>
 #include <atomic>
 #include <future>
 #include <memory>
 #include <vector>
+#include <chrono>
 #include <thread>
-#include <memory>
+#include <cstdint>
+#include <functional>
 
 #include "JoinThreads.h"
 #include "FunctionWrapper.h"
-#include "ThreadSafeQueue.h"
+#include "GlobalQueue.h"
+#include "EventCount.h"
+#include "IdlePolicy.h"
+#include "ThreadPoolBase.h"
+#include "CooperativeWait.h"
+#include "ThreadPlacement.h"
+#include "PriorityLanes.h"
+#include "WorkerStats.h"
+#include "WorkerContext.h"
+#include "TimingWheel.h"
+#ifdef LOCK_FREE_WORK_STEALING
+#include "LockFreeWorkStealingQueue.h"
+#else
 #include "WorkStealingQueue.h"
+#endif //LOCK_FREE_WORK_STEALING
 
-class StaticThreadPoolWithWorkingStealing
+class StaticThreadPoolWithWorkingStealing : public ThreadPoolBase<StaticThreadPoolWithWorkingStealing>,
+                                            public TimerScheduling<StaticThreadPoolWithWorkingStealing>
 {
+#ifdef LOCK_FREE_WORK_STEALING
+    typedef LockFreeWorkStealingQueue<FunctionWrapper> local_queue_type;
+#else
+    typedef WorkStealingQueue<FunctionWrapper> local_queue_type;
+#endif //LOCK_FREE_WORK_STEALING
+
+    struct Worker
+    {
+        explicit Worker(std::size_t t_index)
+                :
+                index(t_index),
+                stealSeed(0x9E3779B97F4A7C15ull * (t_index + 1))
+        {}
+
+        const std::size_t index;
+        // xorshift64 state for picking victims.
+        uint64_t stealSeed;
+        PriorityLanes<local_queue_type> queue;
+        // The surplus of a steal on its way to queue.
+        std::vector<FunctionWrapper> stolen;
+        WorkerStats stats;
+    };
+
 public:
     StaticThreadPoolWithWorkingStealing(const StaticThreadPoolWithWorkingStealing&) = delete;
     StaticThreadPoolWithWorkingStealing& operator=(const StaticThreadPoolWithWorkingStealing&) = delete;
     StaticThreadPoolWithWorkingStealing(StaticThreadPoolWithWorkingStealing&&) = delete;
     StaticThreadPoolWithWorkingStealing& operator=(StaticThreadPoolWithWorkingStealing&&) = delete;
 
-    StaticThreadPoolWithWorkingStealing()
-        : m_done(false), m_joiner(m_threads)
-    {
-        const uint16_t threadsCount = std::thread::hardware_concurrency();
+    explicit StaticThreadPoolWithWorkingStealing(const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : StaticThreadPoolWithWorkingStealing(ThreadPlacement(), t_idlePolicy)
+    {}
 
+    // Every worker builds its own context, queue included, once it is pinned, so
+    // the queue lands on the worker's NUMA node. The constructor returns when
+    // all of them exist.
+    explicit StaticThreadPoolWithWorkingStealing(const ThreadPlacement& t_placement,
+                                                 const IdlePolicy& t_idlePolicy = IdlePolicy())
+        : m_done(false), m_idlePolicy(t_idlePolicy), m_slots(PlanWorkers(t_placement)),
+          m_victims(StealOrder(m_slots)), m_workers(m_slots.size()), m_joiner(m_threads)
+    {
         try
         {
-            for (uint16_t i = 0; i < threadsCount; ++i)
-            {
-                m_queues.push_back(
-                        std::make_unique<WorkStealingQueue<FunctionWrapper>>());
-            }
-            for (uint16_t i = 0; i < threadsCount; ++i)
+            for (std::size_t i = 0; i < m_slots.size(); ++i)
             {
                 m_threads.emplace_back(&StaticThreadPoolWithWorkingStealing::WorkerThread, this, i);
             }
@@ -41,13 +83,17 @@ public:
         catch (...)
         {
             m_done = true;
+            m_wakeup.NotifyAll();
             throw;
         }
+
+        WaitForQueues();
     }
 
     ~StaticThreadPoolWithWorkingStealing()
     {
         m_done = true;
+        m_wakeup.NotifyAll();
     }
 
     template<typename FunctionType>
@@ -55,85 +101,283 @@ public:
     Submit(FunctionType function)
     {
         typedef typename std::result_of<FunctionType()>::type resultType;
-        std::packaged_task<resultType()> task(function);
+        std::packaged_task<resultType()> task(std::move(function));
+        std::future<resultType> result(task.get_future());
+        Post(std::move(task));
+        return result;
+    }
+
+    // Tasks of a higher priority are started first, wherever they are queued;
+    // see LaneOrder() for how the lower lanes still get their turn.
+    template<typename FunctionType>
+    std::future<typename std::result_of<FunctionType()>::type>
+    Submit(TaskPriority t_priority, FunctionType function)
+    {
+        typedef typename std::result_of<FunctionType()>::type resultType;
+        std::packaged_task<resultType()> task(std::move(function));
         std::future<resultType> result(task.get_future());
+        Post(t_priority, std::move(task));
+        return result;
+    }
 
-        if (m_localQueue)
+    // Fire and forget: no future and no shared state.
+    template<typename FunctionType>
+    void Post(FunctionType function)
+    {
+        Post(TaskPriority::Normal, std::move(function));
+    }
+
+    template<typename FunctionType>
+    void Post(TaskPriority t_priority, FunctionType function)
+    {
+        if (Worker* self = m_workers.Current())
         {
-            m_localQueue->Enque(std::move(task));
+            self->queue[t_priority].Enque(FunctionWrapper(std::move(function)));
         }
         else
         {
-            m_mainQueue.Enque(std::move(task));
+            m_mainQueue[t_priority].Enque(FunctionWrapper(std::move(function)));
         }
+        // Tasks on a local queue can be stolen, so a sleeper is woken either way.
+        m_wakeup.NotifyOne();
+    }
 
-        return result;
+    // Waits for a std::future, std::shared_future or TaskFuture. On a worker of
+    // this pool it keeps running pending tasks until the result is ready, so a
+    // task can wait for its children without blocking its thread.
+    template<typename Future>
+    void WaitFor(const Future& t_future)
+    {
+        WaitForFuture(*this, t_future);
     }
 
-private:
-    void WorkerThread(uint16_t t_myIndex)
+    // Runs one task from the local, the pool or another worker's queue. Meant for
+    // a worker that waits for other tasks (see WaitFor() and TaskGroup), so that
+    // it helps instead of blocking. Returns false if there was nothing to run.
+    // The own queue is searched in all lanes first, so a worker that has work
+    // never takes the pool queue's lock or probes a victim; then the pool
+    // queue, and stealing comes last.
+    bool RunPendingTask()
     {
-        m_myIndex = t_myIndex;
-        m_localQueue = m_queues[m_myIndex].get();
+        Worker* self = m_workers.Current();
+        if (!self)
+        {
+            return RunPendingTaskOutsidePool();
+        }
 
-        while (!m_done)
+        FunctionWrapper task;
+        const auto lanes = LaneOrder();
+        if (PopFromLanes(lanes, [self, &task](std::size_t lane)
+        {
+            return self->queue.Lane(lane).TryDeque(task);
+        }))
+        {
+            self->stats.LocalPop();
+        }
+        else if (PopFromLanes(lanes, [this, &task](std::size_t lane)
+        {
+            return PopTaskFromPoolQueue(task, lane);
+        }))
+        {
+            self->stats.GlobalPop();
+        }
+        else if (PopTaskFromOtherThreadQueue(*self, task, lanes))
         {
-            RunPendingTask();
+            self->stats.Stolen();
         }
+        else
+        {
+            return false;
+        }
+
+        self->stats.Run(task);
+        return true;
     }
 
-    void RunPendingTask()
+    bool IsWorkerThread() const
     {
-        FunctionWrapper task;
+        return m_workers.Current() != nullptr;
+    }
 
-        if (PopTaskFromLocalQueue(task) ||
-            PopTaskFromPoolQueue(task) ||
-            PopTaskFromOtherThreadQueue(task))
+    std::size_t ThreadCount() const
+    {
+        return m_threads.size();
+    }
+
+    // Per-worker counters and latency histograms, all zero unless the pool is
+    // built with THREAD_POOL_STATS. queuedTasks counts the pool queue only.
+    PoolStats Stats() const
+    {
+        PoolStats stats;
+        for (std::size_t i = 0; i < m_workers.Size(); ++i)
         {
-            task();
+            stats.workers.push_back(m_workers.IsBuilt(i) ? m_workers[i].stats.Snapshot() : WorkerStatsSnapshot());
         }
-        else
+        for (std::size_t lane = 0; lane < TaskPriorityLevels; ++lane)
         {
-            std::this_thread::yield();
+            stats.queuedTasks += m_mainQueue.Lane(lane).Size();
         }
+        return stats;
     }
 
-    static inline bool PopTaskFromLocalQueue(FunctionWrapper& task)
+private:
+    friend class ThreadPoolBase<StaticThreadPoolWithWorkingStealing>;
+    friend class TimerScheduling<StaticThreadPoolWithWorkingStealing>;
+
+    void EnqueBatch(std::vector<FunctionWrapper>& t_tasks)
     {
-        return m_localQueue && m_localQueue->TryDeque(task);
+        if (Worker* self = m_workers.Current())
+        {
+            self->queue[TaskPriority::Normal].EnqueBulk(t_tasks.begin(), t_tasks.end());
+        }
+        else
+        {
+            m_mainQueue[TaskPriority::Normal].EnqueBulk(t_tasks.begin(), t_tasks.end());
+        }
+        m_wakeup.NotifyMany(t_tasks.size());
     }
 
-    inline bool PopTaskFromPoolQueue(FunctionWrapper& task)
+    void WorkerThread(std::size_t t_index)
     {
-        return m_mainQueue.TryDeque(task);
+        PinCurrentThread(m_slots[t_index].cpu);
+        Worker& self = m_workers.Emplace(t_index, t_index);
+        m_queuesReady.fetch_add(1, std::memory_order_release);
+        WaitForQueues();
+
+        RunWorkerLoop(m_done, m_wakeup, m_idlePolicy, self.stats, [this]()
+        {
+            return RunPendingTask();
+        });
     }
 
-    inline bool PopTaskFromOtherThreadQueue(FunctionWrapper& task)
+    // A thread outside the pool only helps with the pool queue and takes single
+    // tasks from the workers, since it has no queue for the surplus of a steal.
+    // Nothing is counted in the stats.
+    bool RunPendingTaskOutsidePool()
     {
-        for (size_t i = 0; i < m_queues.size(); ++i)
+        FunctionWrapper task;
+        const auto lanes = LaneOrder();
+        const bool found = PopFromLanes(lanes, [this, &task](std::size_t lane)
+        {
+            return PopTaskFromPoolQueue(task, lane);
+        }) || PopFromLanes(lanes, [this, &task](std::size_t lane)
         {
-            const uint16_t index = (m_myIndex + i + 1) % m_queues.size();
+            for (std::size_t i = 0; i < m_workers.Size(); ++i)
+            {
+                if (m_workers[i].queue.Lane(lane).TrySteal(task))
+                {
+                    return true;
+                }
+            }
+            return false;
+        });
+        if (found)
+        {
+            task();
+        }
+        return found;
+    }
 
-            if (m_queues[index]->TrySteal(task))
+    template<typename Pop>
+    static bool PopFromLanes(const std::array<std::size_t, TaskPriorityLevels>& t_lanes, Pop t_pop)
+    {
+        for (std::size_t lane : t_lanes)
+        {
+            if (t_pop(lane))
             {
                 return true;
             }
         }
+        return false;
+    }
+
+    inline bool PopTaskFromPoolQueue(FunctionWrapper& task, std::size_t lane)
+    {
+        return m_mainQueue.Lane(lane).TryDeque(task);
+    }
+
+    void WaitForQueues()
+    {
+        while (m_queuesReady.load(std::memory_order_acquire) < m_workers.Size() && !m_done)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // Victims on the thief's own NUMA node come first. Within each group the
+    // search starts at a random victim, so that thieves do not all queue up on
+    // the same one. A worker takes half of the victim's tasks at once: it runs
+    // the oldest and keeps the others in its own queue, where they can be stolen
+    // again. Each victim is probed once, lane by lane, and counts as one failed
+    // steal if all its lanes are empty.
+    inline bool PopTaskFromOtherThreadQueue(Worker& self, FunctionWrapper& task,
+                                            const std::array<std::size_t, TaskPriorityLevels>& t_lanes)
+    {
+        const VictimOrder& order = m_victims[self.index];
+        const std::size_t groups[] = {0, order.sameNode, order.victims.size()};
+
+        for (std::size_t group = 0; group < 2; ++group)
+        {
+            const std::size_t first = groups[group];
+            const std::size_t count = groups[group + 1] - first;
+            if (count == 0)
+            {
+                continue;
+            }
+            const std::size_t start = static_cast<std::size_t>(NextStealRandom(self) % count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                Worker& victim = m_workers[order.victims[first + (start + i) % count]];
+                if (PopFromLanes(t_lanes, [&self, &victim, &task](std::size_t lane)
+                {
+                    return StealFrom(self, victim.queue.Lane(lane), task, lane);
+                }))
+                {
+                    return true;
+                }
+                self.stats.FailedSteal();
+            }
+        }
 
         return false;
     }
 
+    static inline bool StealFrom(Worker& self, local_queue_type& victim, FunctionWrapper& task, std::size_t lane)
+    {
+        self.stolen.clear();
+        if (victim.TryStealHalf(task, self.stolen, StealBatchLimit) == 0)
+        {
+            return false;
+        }
+        // These tasks were announced when they were posted, so nobody is woken.
+        self.queue.Lane(lane).EnqueBulk(self.stolen.begin(), self.stolen.end());
+        return true;
+    }
+
+    // xorshift64: cheap, and good enough to spread the thieves out.
+    static uint64_t NextStealRandom(Worker& self)
+    {
+        self.stealSeed ^= self.stealSeed << 13;
+        self.stealSeed ^= self.stealSeed >> 7;
+        self.stealSeed ^= self.stealSeed << 17;
+        return self.stealSeed;
+    }
+
 private:
+    // Upper bound on the tasks one steal moves over.
+    static constexpr std::size_t StealBatchLimit = 32;
+
     std::atomic_bool m_done;
-    ThreadSafeQueue<FunctionWrapper> m_mainQueue;
-    std::vector<std::unique_ptr<WorkStealingQueue<FunctionWrapper>>> m_queues;
+    const IdlePolicy m_idlePolicy;
+    EventCount m_wakeup;
+    PriorityLanes<DefaultGlobalQueue<FunctionWrapper>> m_mainQueue;
+    const std::vector<WorkerSlot> m_slots;
+    const std::vector<VictimOrder> m_victims;
+    WorkerContexts<Worker> m_workers;
+    std::atomic<std::size_t> m_queuesReady{0};
+    TimingWheel m_timers{[this](FunctionWrapper&& t_task) { Post(std::move(t_task)); }};
     std::vector<std::thread> m_threads;
     JoinThreads m_joiner;
-    static thread_local WorkStealingQueue<FunctionWrapper>* m_localQueue;
-    static thread_local uint16_t m_myIndex;
 };
 
-thread_local WorkStealingQueue<FunctionWrapper>* StaticThreadPoolWithWorkingStealing::m_localQueue;
-thread_local uint16_t StaticThreadPoolWithWorkingStealing::m_myIndex;
-
 #endif //THREAD_POOLS_STATIC_THREAD_POOL_WITH_WORK_STEALING_H
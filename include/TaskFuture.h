@@ -0,0 +1,543 @@
+#ifndef THREAD_POOLS_TASK_FUTURE_H
+#define THREAD_POOLS_TASK_FUTURE_H
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <cstdint>
+#include <utility>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <condition_variable>
+
+#include "FreeList.h"
+#include "IdlePolicy.h"
+#include "FunctionWrapper.h"
+
+template<typename T>
+class TaskPromise;
+
+// A lighter promise/future pair than the std::packaged_task one. The shared
+// state comes from the free list of the thread that creates it and goes back to
+// the free list of the thread that drops the last reference, so a steady flow of
+// tasks reuses the same blocks. Get() spins for a while before it blocks.
+namespace detail
+{
+    struct Unit
+    {};
+
+    template<typename T, typename FunctionType>
+    struct ContinuationResult
+    {
+        typedef std::invoke_result_t<FunctionType, T> type;
+    };
+
+    template<typename FunctionType>
+    struct ContinuationResult<void, FunctionType>
+    {
+        typedef std::invoke_result_t<FunctionType> type;
+    };
+
+    template<typename T>
+    class TaskState
+    {
+        typedef std::conditional_t<std::is_void_v<T>, Unit, T> stored_type;
+        typedef ThreadLocalFreeList<TaskState> free_list;
+
+    public:
+        static TaskState* Create()
+        {
+            return ::new (free_list::Allocate()) TaskState();
+        }
+
+        void Release()
+        {
+            if (m_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                this->~TaskState();
+                free_list::Deallocate(this);
+            }
+        }
+
+        template<typename... Args>
+        void SetValue(Args&&... t_args)
+        {
+            m_value.emplace(std::forward<Args>(t_args)...);
+            MarkReady();
+        }
+
+        void SetException(std::exception_ptr t_exception)
+        {
+            m_exception = std::move(t_exception);
+            MarkReady();
+        }
+
+        bool IsReady() const
+        {
+            return m_ready.load(std::memory_order_acquire);
+        }
+
+        void Wait()
+        {
+            const IdlePolicy policy;
+            IdleBackoff backoff(policy);
+            while (!IsReady())
+            {
+                if (!backoff.Spin())
+                {
+                    Block();
+                    return;
+                }
+            }
+        }
+
+        // t_callback runs on the thread that makes the state ready, or right
+        // here if it already is. Callbacks attached to the same state all run.
+        void OnReady(FunctionWrapper t_callback)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_callback)
+                {
+                    m_callback = [first = std::move(m_callback), second = std::move(t_callback)]() mutable
+                    {
+                        first();
+                        second();
+                    };
+                }
+                else
+                {
+                    m_callback = std::move(t_callback);
+                }
+                m_hasCallback.store(true, std::memory_order_seq_cst);
+            }
+            if (m_ready.load(std::memory_order_seq_cst))
+            {
+                RunCallback();
+            }
+        }
+
+        stored_type Take()
+        {
+            Wait();
+            if (m_exception)
+            {
+                std::rethrow_exception(m_exception);
+            }
+            return std::move(*m_value);
+        }
+
+    private:
+        TaskState() = default;
+        ~TaskState() = default;
+
+        // Ready and the callback flag are each stored before the other one is
+        // loaded, so at least one of MarkReady() and OnReady() sees both; taking
+        // the callback under the mutex makes sure it runs only once.
+        void MarkReady()
+        {
+            m_ready.store(true, std::memory_order_seq_cst);
+            if (m_sleeping.load(std::memory_order_seq_cst))
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                }
+                m_is_ready.notify_all();
+            }
+            if (m_hasCallback.load(std::memory_order_seq_cst))
+            {
+                RunCallback();
+            }
+        }
+
+        void RunCallback()
+        {
+            FunctionWrapper callback;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                callback = std::move(m_callback);
+            }
+            if (callback)
+            {
+                callback();
+            }
+        }
+
+        void Block()
+        {
+            m_sleeping.store(true, std::memory_order_seq_cst);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_is_ready.wait(lock, [this]
+            {
+                return m_ready.load(std::memory_order_seq_cst);
+            });
+        }
+
+    private:
+        std::optional<stored_type> m_value;
+        std::exception_ptr m_exception;
+        std::atomic_bool m_ready{false};
+        std::atomic_bool m_sleeping{false};
+        std::atomic_bool m_hasCallback{false};
+        FunctionWrapper m_callback;
+        std::atomic<uint32_t> m_references{2};
+        std::condition_variable m_is_ready;
+        std::mutex m_mutex;
+    };
+}
+
+template<typename T>
+class TaskFuture
+{
+    template<typename U> friend class TaskPromise;
+
+public:
+    TaskFuture() = default;
+    TaskFuture(const TaskFuture&) = delete;
+    TaskFuture& operator=(const TaskFuture&) = delete;
+
+    TaskFuture(TaskFuture&& other) noexcept
+            :
+            m_state(std::exchange(other.m_state, nullptr))
+    {}
+
+    TaskFuture& operator=(TaskFuture&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_state = std::exchange(other.m_state, nullptr);
+        }
+        return *this;
+    }
+
+    ~TaskFuture()
+    {
+        Reset();
+    }
+
+    bool Valid() const
+    {
+        return m_state != nullptr;
+    }
+
+    bool IsReady() const
+    {
+        return m_state->IsReady();
+    }
+
+    void Wait() const
+    {
+        m_state->Wait();
+    }
+
+    T Get()
+    {
+        detail::TaskState<T>* state = std::exchange(m_state, nullptr);
+        struct Releaser
+        {
+            detail::TaskState<T>* state;
+            ~Releaser()
+            {
+                state->Release();
+            }
+        } releaser{state};
+
+        if constexpr (std::is_void_v<T>)
+        {
+            state->Take();
+        }
+        else
+        {
+            return state->Take();
+        }
+    }
+
+    // Runs t_callback once the result is there: on the thread that provides it,
+    // or right away if it is already there. The callback should be short and
+    // must not block; Then() is for real work.
+    void OnReady(FunctionWrapper t_callback)
+    {
+        m_state->OnReady(std::move(t_callback));
+    }
+
+    // Posts function to t_pool once the result is there, instead of blocking a
+    // thread on Get() in the meantime. function gets the result (nothing for
+    // TaskFuture<void>); an exception of this task is passed on to the returned
+    // future without calling function. The future is consumed.
+    template<typename ThreadPool, typename FunctionType>
+    auto Then(ThreadPool& t_pool, FunctionType function)
+    {
+        typedef typename detail::ContinuationResult<T, FunctionType>::type resultType;
+        TaskPromise<resultType> promise;
+        TaskFuture<resultType> result(promise.GetFuture());
+        detail::TaskState<T>* state = m_state;
+        state->OnReady([&t_pool, antecedent = std::move(*this), promise = std::move(promise),
+                        function = std::move(function)]() mutable
+        {
+            t_pool.Post([antecedent = std::move(antecedent), promise = std::move(promise),
+                         function = std::move(function)]() mutable
+            {
+                auto call = [&]() -> resultType
+                {
+                    if constexpr (std::is_void_v<T>)
+                    {
+                        antecedent.Get();
+                        return function();
+                    }
+                    else
+                    {
+                        return function(antecedent.Get());
+                    }
+                };
+                promise.Fulfill(call);
+            });
+        });
+        return result;
+    }
+
+private:
+    explicit TaskFuture(detail::TaskState<T>* t_state)
+            :
+            m_state(t_state)
+    {}
+
+    void Reset()
+    {
+        if (m_state)
+        {
+            std::exchange(m_state, nullptr)->Release();
+        }
+    }
+
+private:
+    detail::TaskState<T>* m_state = nullptr;
+};
+
+template<typename T>
+class TaskPromise
+{
+public:
+    TaskPromise()
+            :
+            m_state(detail::TaskState<T>::Create())
+    {}
+
+    TaskPromise(const TaskPromise&) = delete;
+    TaskPromise& operator=(const TaskPromise&) = delete;
+
+    TaskPromise(TaskPromise&& other) noexcept
+            :
+            m_state(std::exchange(other.m_state, nullptr)),
+            m_futureRetrieved(other.m_futureRetrieved)
+    {}
+
+    TaskPromise& operator=(TaskPromise&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Abandon();
+            m_state = std::exchange(other.m_state, nullptr);
+            m_futureRetrieved = other.m_futureRetrieved;
+        }
+        return *this;
+    }
+
+    ~TaskPromise()
+    {
+        Abandon();
+    }
+
+    TaskFuture<T> GetFuture()
+    {
+        if (m_futureRetrieved)
+        {
+            throw std::future_error(std::future_errc::future_already_retrieved);
+        }
+        m_futureRetrieved = true;
+        return TaskFuture<T>(m_state);
+    }
+
+    template<typename... Args>
+    void SetValue(Args&&... t_args)
+    {
+        m_state->SetValue(std::forward<Args>(t_args)...);
+        Finish();
+    }
+
+    void SetException(std::exception_ptr t_exception)
+    {
+        m_state->SetException(std::move(t_exception));
+        Finish();
+    }
+
+    // Runs t_function and stores whatever it returns or throws.
+    template<typename FunctionType>
+    void Fulfill(FunctionType& t_function)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                t_function();
+                SetValue();
+            }
+            else
+            {
+                SetValue(t_function());
+            }
+        }
+        catch (...)
+        {
+            SetException(std::current_exception());
+        }
+    }
+
+private:
+    void Finish()
+    {
+        m_state->Release();
+        m_state = nullptr;
+    }
+
+    void Abandon()
+    {
+        if (!m_state)
+        {
+            return;
+        }
+        if (!m_futureRetrieved)
+        {
+            // Nobody will ever look at the result: drop the future's reference too.
+            m_state->Release();
+        }
+        else
+        {
+            m_state->SetException(std::make_exception_ptr(
+                    std::future_error(std::future_errc::broken_promise)));
+        }
+        Finish();
+    }
+
+private:
+    detail::TaskState<T>* m_state;
+    bool m_futureRetrieved = false;
+};
+
+// Ready once all t_futures are: with every result in the order of t_futures,
+// or with the first exception among them.
+template<typename T>
+auto WhenAll(std::vector<TaskFuture<T>> t_futures)
+{
+    typedef std::conditional_t<std::is_void_v<T>, void, std::vector<T>> resultType;
+
+    struct Shared
+    {
+        std::vector<TaskFuture<T>> futures;
+        std::atomic<std::size_t> remaining;
+        TaskPromise<resultType> promise;
+
+        void Finish()
+        {
+            auto collect = [this]() -> resultType
+            {
+                if constexpr (std::is_void_v<T>)
+                {
+                    for (TaskFuture<T>& future : futures)
+                    {
+                        future.Get();
+                    }
+                }
+                else
+                {
+                    std::vector<T> values;
+                    values.reserve(futures.size());
+                    for (TaskFuture<T>& future : futures)
+                    {
+                        values.push_back(future.Get());
+                    }
+                    return values;
+                }
+            };
+            promise.Fulfill(collect);
+        }
+    };
+
+    auto shared = std::make_shared<Shared>();
+    shared->futures = std::move(t_futures);
+    // One extra count for this loop, so Finish() cannot start while it runs.
+    shared->remaining.store(shared->futures.size() + 1, std::memory_order_relaxed);
+    TaskFuture<resultType> result(shared->promise.GetFuture());
+    auto arrive = [shared]()
+    {
+        if (shared->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            shared->Finish();
+        }
+    };
+    for (TaskFuture<T>& future : shared->futures)
+    {
+        future.OnReady(arrive);
+    }
+    arrive();
+    return result;
+}
+
+template<typename T>
+struct WhenAnyResult
+{
+    std::size_t index;
+    std::vector<TaskFuture<T>> futures;
+};
+
+// Ready as soon as one of t_futures is. The result hands all futures back,
+// together with the index of the one that was first.
+template<typename T>
+TaskFuture<WhenAnyResult<T>> WhenAny(std::vector<TaskFuture<T>> t_futures)
+{
+    if (t_futures.empty())
+    {
+        throw std::invalid_argument("WhenAny() needs at least one future");
+    }
+
+    struct Shared
+    {
+        std::vector<TaskFuture<T>> futures;
+        std::atomic<std::size_t> first{SIZE_MAX};
+        std::atomic<int> gate{2};
+        TaskPromise<WhenAnyResult<T>> promise;
+
+        // Both the first ready future and the end of the loop below pass the
+        // gate; the futures are moved out only after both.
+        void Pass()
+        {
+            if (gate.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                promise.SetValue(WhenAnyResult<T>{first.load(std::memory_order_relaxed), std::move(futures)});
+            }
+        }
+    };
+
+    auto shared = std::make_shared<Shared>();
+    shared->futures = std::move(t_futures);
+    TaskFuture<WhenAnyResult<T>> result(shared->promise.GetFuture());
+    for (std::size_t i = 0; i < shared->futures.size(); ++i)
+    {
+        shared->futures[i].OnReady([shared, i]()
+        {
+            std::size_t none = SIZE_MAX;
+            if (shared->first.compare_exchange_strong(none, i, std::memory_order_acq_rel))
+            {
+                shared->Pass();
+            }
+        });
+    }
+    shared->Pass();
+    return result;
+}
+
+#endif //THREAD_POOLS_TASK_FUTURE_H
@@ -0,0 +1,191 @@
+#ifndef THREAD_POOLS_TASK_GRAPH_H
+#define THREAD_POOLS_TASK_GRAPH_H
+
+#include <deque>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <stdexcept>
+
+#include "FunctionWrapper.h"
+#include "FirstException.h"
+#include "CompletionLatch.h"
+
+// A set of tasks with dependencies between them that can be run as often as
+// needed. Every node counts its predecessors; a run counts that down, and the
+// worker that finishes the last predecessor of a node runs the node itself and
+// posts any further ready successors, which on the local-queue and
+// work-stealing pools puts them on its own queue. Apart from those posts a run
+// allocates nothing. The first run after a change checks that the graph is
+// acyclic. The graph must not change during a run.
+class TaskGraph
+{
+    struct Node
+    {
+        explicit Node(FunctionWrapper t_task)
+                :
+                task(std::move(t_task))
+        {}
+
+        FunctionWrapper task;
+        std::vector<Node*> successors;
+        std::size_t predecessors = 0;
+        std::atomic<std::size_t> pending{0};
+    };
+
+public:
+    typedef std::size_t NodeId;
+
+    TaskGraph() = default;
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+    TaskGraph(TaskGraph&&) = delete;
+    TaskGraph& operator=(TaskGraph&&) = delete;
+
+    template<typename FunctionType>
+    NodeId Add(FunctionType function)
+    {
+        m_nodes.emplace_back(FunctionWrapper(std::move(function)));
+        m_checked = false;
+        return m_nodes.size() - 1;
+    }
+
+    // t_after starts only once t_before has finished.
+    void Precede(NodeId t_before, NodeId t_after)
+    {
+        m_nodes.at(t_before).successors.push_back(&m_nodes.at(t_after));
+        ++m_nodes[t_after].predecessors;
+        m_checked = false;
+    }
+
+    std::size_t Size() const
+    {
+        return m_nodes.size();
+    }
+
+    // Runs every node once and waits, on a worker of t_pool by running other
+    // tasks of the pool. Once a node has thrown, the nodes that have not
+    // started yet are skipped, and the exception is rethrown here. Throws
+    // std::logic_error, before running anything, if the graph has a cycle.
+    template<typename ThreadPool>
+    void Run(ThreadPool& t_pool)
+    {
+        if (m_nodes.empty())
+        {
+            return;
+        }
+        if (!m_checked)
+        {
+            CheckAcyclic();
+        }
+
+        CompletionLatch latch(m_nodes.size());
+        m_latch = &latch;
+        m_failed.store(false, std::memory_order_relaxed);
+        for (Node& node : m_nodes)
+        {
+            node.pending.store(node.predecessors, std::memory_order_relaxed);
+        }
+
+        for (Node& node : m_nodes)
+        {
+            if (node.predecessors == 0)
+            {
+                Schedule(t_pool, &node);
+            }
+        }
+        latch.Wait(t_pool);
+        m_failure.RethrowIfAny();
+    }
+
+private:
+    // Kahn's algorithm on the pending counters: if removing the nodes without
+    // predecessors over and over does not reach every node, the rest is a cycle.
+    void CheckAcyclic()
+    {
+        std::vector<Node*> ready;
+        for (Node& node : m_nodes)
+        {
+            node.pending.store(node.predecessors, std::memory_order_relaxed);
+            if (node.predecessors == 0)
+            {
+                ready.push_back(&node);
+            }
+        }
+
+        std::size_t visited = 0;
+        while (!ready.empty())
+        {
+            Node* node = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (Node* successor : node->successors)
+            {
+                if (successor->pending.fetch_sub(1, std::memory_order_relaxed) == 1)
+                {
+                    ready.push_back(successor);
+                }
+            }
+        }
+        if (visited != m_nodes.size())
+        {
+            throw std::logic_error("TaskGraph has a cycle");
+        }
+        m_checked = true;
+    }
+
+    template<typename ThreadPool>
+    void Schedule(ThreadPool& t_pool, Node* t_node)
+    {
+        t_pool.Post([this, &t_pool, t_node]()
+        {
+            Execute(t_pool, t_node);
+        });
+    }
+
+    template<typename ThreadPool>
+    void Execute(ThreadPool& t_pool, Node* t_node)
+    {
+        while (t_node)
+        {
+            if (!m_failed.load(std::memory_order_relaxed))
+            {
+                try
+                {
+                    t_node->task();
+                }
+                catch (...)
+                {
+                    m_failed.store(true, std::memory_order_relaxed);
+                    m_failure.Capture();
+                }
+            }
+
+            Node* next = nullptr;
+            for (Node* successor : t_node->successors)
+            {
+                if (successor->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    if (next)
+                    {
+                        Schedule(t_pool, next);
+                    }
+                    next = successor;
+                }
+            }
+            // After the last CountDown() the graph may be gone; next is null then.
+            m_latch->CountDown();
+            t_node = next;
+        }
+    }
+
+private:
+    std::deque<Node> m_nodes;
+    CompletionLatch* m_latch = nullptr;
+    std::atomic_bool m_failed{false};
+    FirstException m_failure;
+    bool m_checked = false;
+};
+
+#endif //THREAD_POOLS_TASK_GRAPH_H
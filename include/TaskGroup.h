@@ -0,0 +1,117 @@
+#ifndef THREAD_POOLS_TASK_GROUP_H
+#define THREAD_POOLS_TASK_GROUP_H
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <utility>
+#include <condition_variable>
+
+#include "FirstException.h"
+
+// A set of fire-and-forget tasks that can be waited for as a whole. Tasks may
+// add more tasks to the same group while it is being waited for. Wait() on a
+// worker of the pool runs pending tasks instead of blocking, and rethrows the
+// first exception a task of the group has thrown.
+template<typename ThreadPool>
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& t_pool)
+            :
+            m_pool(t_pool)
+    {}
+
+    ~TaskGroup()
+    {
+        WaitForAll();
+    }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    TaskGroup(TaskGroup&&) = delete;
+    TaskGroup& operator=(TaskGroup&&) = delete;
+
+    template<typename FunctionType>
+    void Run(FunctionType function)
+    {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        m_pool.Post([this, function = std::move(function)]() mutable
+        {
+            try
+            {
+                function();
+            }
+            catch (...)
+            {
+                m_failure.Capture();
+            }
+            Done();
+        });
+    }
+
+    void Wait()
+    {
+        WaitForAll();
+        m_failure.RethrowIfAny();
+    }
+
+private:
+    void Done()
+    {
+        std::size_t pending = m_pending.load(std::memory_order_relaxed);
+        while (pending > 1)
+        {
+            if (m_pending.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel))
+            {
+                return;
+            }
+        }
+
+        // The last task drops the count to zero under the mutex, so a waiter that
+        // saw zero and then took the mutex knows nobody touches the group any more.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            m_all_done.notify_all();
+        }
+    }
+
+    bool IsDone() const
+    {
+        return m_pending.load(std::memory_order_acquire) == 0;
+    }
+
+    void WaitForAll()
+    {
+        if (m_pool.IsWorkerThread())
+        {
+            while (!IsDone())
+            {
+                if (!m_pool.RunPendingTask())
+                {
+                    std::this_thread::yield();
+                }
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_all_done.wait(lock, [this]
+            {
+                return IsDone();
+            });
+        }
+    }
+
+private:
+    ThreadPool& m_pool;
+    std::atomic<std::size_t> m_pending{0};
+    FirstException m_failure;
+    std::condition_variable m_all_done;
+    std::mutex m_mutex;
+};
+
+#endif //THREAD_POOLS_TASK_GROUP_H
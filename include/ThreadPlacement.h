@@ -0,0 +1,305 @@
+#ifndef THREAD_POOLS_THREAD_PLACEMENT_H
+#define THREAD_POOLS_THREAD_PLACEMENT_H
+
+#include <map>
+#include <tuple>
+#include <string>
+#include <utility>
+#include <vector>
+#include <thread>
+#include <cctype>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif //__linux__
+
+// How the workers of a pool are spread over the CPUs.
+//   None    - the workers are not pinned, the scheduler moves them around
+//   Compact - fill one NUMA node (and each core's hyper-threads) before the next
+//   Scatter - round robin over the nodes, one thread per core before siblings
+enum class AffinityPolicy
+{
+    None,
+    Compact,
+    Scatter
+};
+
+// Above this a threadCount is taken for a mistake: PlanWorkers() throws
+// std::invalid_argument instead of starting the threads.
+constexpr std::size_t MaxThreadCount = UINT16_MAX;
+
+// threadCount 0 means one worker per usable CPU. cpus restricts the pool to the
+// listed CPUs; empty means every CPU the process may run on.
+struct ThreadPlacement
+{
+    std::size_t threadCount = 0;
+    AffinityPolicy affinity = AffinityPolicy::None;
+    std::vector<int> cpus;
+};
+
+struct CpuInfo
+{
+    int id;
+    int node;
+    int package;
+    int core;
+};
+
+// Where a worker runs. cpu is -1 for a worker that is not pinned.
+struct WorkerSlot
+{
+    int cpu;
+    int node;
+};
+
+// The CPUs the process may run on, with their NUMA node, socket and core as the
+// kernel reports them under /sys. Elsewhere (or if /sys is not readable) every
+// CPU is taken to be its own core on node 0.
+class CpuTopology
+{
+public:
+    CpuTopology()
+    {
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &allowed))
+                {
+                    m_cpus.push_back(CpuInfo{cpu, 0, ReadId(cpu, "physical_package_id"), ReadId(cpu, "core_id")});
+                }
+            }
+            ReadNodes();
+        }
+#endif //__linux__
+        if (m_cpus.empty())
+        {
+            const int count = std::max(1u, std::thread::hardware_concurrency());
+            for (int cpu = 0; cpu < count; ++cpu)
+            {
+                m_cpus.push_back(CpuInfo{cpu, 0, 0, cpu});
+            }
+        }
+    }
+
+    // A layout given by hand, e.g. to plan for a machine other than this one.
+    explicit CpuTopology(std::vector<CpuInfo> t_cpus)
+            :
+            m_cpus(std::move(t_cpus))
+    {}
+
+    const std::vector<CpuInfo>& Cpus() const
+    {
+        return m_cpus;
+    }
+
+private:
+#ifdef __linux__
+    static int ReadId(int t_cpu, const char* t_name)
+    {
+        std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(t_cpu) + "/topology/" + t_name);
+        int id = -1;
+        return file >> id ? id : t_cpu;
+    }
+
+    void ReadNodes()
+    {
+        std::error_code error;
+        for (std::filesystem::directory_iterator entry("/sys/devices/system/node", error), end;
+             !error && entry != end; entry.increment(error))
+        {
+            const std::string name = entry->path().filename().string();
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos)
+            {
+                continue;
+            }
+
+            std::ifstream file(entry->path() / "cpulist");
+            std::string list;
+            if (!std::getline(file, list))
+            {
+                continue;
+            }
+
+            const int node = std::stoi(name.substr(4));
+            for (int cpu : ParseCpuList(list))
+            {
+                for (CpuInfo& info : m_cpus)
+                {
+                    if (info.id == cpu)
+                    {
+                        info.node = node;
+                    }
+                }
+            }
+        }
+    }
+
+    // "0-3,8,10-11"
+    static std::vector<int> ParseCpuList(const std::string& t_list)
+    {
+        std::vector<int> cpus;
+        std::size_t pos = 0;
+        while (pos < t_list.size() && std::isdigit(static_cast<unsigned char>(t_list[pos])))
+        {
+            std::size_t used;
+            const int first = std::stoi(t_list.substr(pos), &used);
+            pos += used;
+            int last = first;
+            if (pos < t_list.size() && t_list[pos] == '-')
+            {
+                last = std::stoi(t_list.substr(pos + 1), &used);
+                pos += used + 1;
+            }
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+            if (pos < t_list.size() && t_list[pos] == ',')
+            {
+                ++pos;
+            }
+        }
+        return cpus;
+    }
+#endif //__linux__
+
+private:
+    std::vector<CpuInfo> m_cpus;
+};
+
+// One slot per worker. With more workers than CPUs the CPUs are handed out again
+// from the start.
+inline std::vector<WorkerSlot> PlanWorkers(const ThreadPlacement& t_placement,
+                                           const CpuTopology& t_topology = CpuTopology())
+{
+    std::vector<CpuInfo> cpus;
+    for (const CpuInfo& info : t_topology.Cpus())
+    {
+        if (t_placement.cpus.empty() ||
+            std::find(t_placement.cpus.begin(), t_placement.cpus.end(), info.id) != t_placement.cpus.end())
+        {
+            cpus.push_back(info);
+        }
+    }
+    if (cpus.empty())
+    {
+        cpus = t_topology.Cpus();
+    }
+
+    std::sort(cpus.begin(), cpus.end(), [](const CpuInfo& t_lhs, const CpuInfo& t_rhs)
+    {
+        return std::tie(t_lhs.node, t_lhs.package, t_lhs.core, t_lhs.id) <
+               std::tie(t_rhs.node, t_rhs.package, t_rhs.core, t_rhs.id);
+    });
+
+    if (t_placement.affinity == AffinityPolicy::Scatter)
+    {
+        // Deal the CPUs out node by node: the first core of every node, then the
+        // second one and so on; hyper-threads of a core come after all cores.
+        std::vector<std::tuple<std::size_t, std::size_t, int, std::size_t>> keys;
+        std::map<std::pair<int, std::size_t>, std::size_t> nextRank;
+        std::size_t sibling = 0;
+        for (std::size_t i = 0; i < cpus.size(); ++i)
+        {
+            const bool sameCore = i > 0 && cpus[i].node == cpus[i - 1].node &&
+                                  cpus[i].package == cpus[i - 1].package && cpus[i].core == cpus[i - 1].core;
+            sibling = sameCore ? sibling + 1 : 0;
+            keys.emplace_back(sibling, nextRank[std::make_pair(cpus[i].node, sibling)]++, cpus[i].node, i);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<CpuInfo> scattered;
+        for (const auto& key : keys)
+        {
+            scattered.push_back(cpus[std::get<3>(key)]);
+        }
+        cpus.swap(scattered);
+    }
+
+    const std::size_t count = t_placement.threadCount != 0 ? t_placement.threadCount : cpus.size();
+    if (count > MaxThreadCount)
+    {
+        throw std::invalid_argument("ThreadPlacement::threadCount is above MaxThreadCount");
+    }
+    std::vector<WorkerSlot> slots;
+    slots.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const CpuInfo& info = cpus[i % cpus.size()];
+        if (t_placement.affinity == AffinityPolicy::None)
+        {
+            slots.push_back(WorkerSlot{-1, 0});
+        }
+        else
+        {
+            slots.push_back(WorkerSlot{info.id, info.node});
+        }
+    }
+    return slots;
+}
+
+// Binds the calling thread to t_cpu. Does nothing for -1 or where the platform
+// has no affinity call; a CPU the process may not use is ignored as well.
+inline void PinCurrentThread(int t_cpu)
+{
+#ifdef __linux__
+    if (t_cpu < 0 || t_cpu >= CPU_SETSIZE)
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(t_cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) t_cpu;
+#endif //__linux__
+}
+
+// The workers a worker may steal from: the first sameNode of them are on its
+// own node, the others are not.
+struct VictimOrder
+{
+    std::vector<std::size_t> victims;
+    std::size_t sameNode = 0;
+};
+
+// For each worker the other workers, those on its own node first, each group
+// in ring order after itself.
+inline std::vector<VictimOrder> StealOrder(const std::vector<WorkerSlot>& t_slots)
+{
+    std::vector<VictimOrder> order(t_slots.size());
+    for (std::size_t i = 0; i < t_slots.size(); ++i)
+    {
+        for (int sameNode = 1; sameNode >= 0; --sameNode)
+        {
+            for (std::size_t step = 1; step < t_slots.size(); ++step)
+            {
+                const std::size_t victim = (i + step) % t_slots.size();
+                if ((t_slots[victim].node == t_slots[i].node) == static_cast<bool>(sameNode))
+                {
+                    order[i].victims.push_back(victim);
+                }
+            }
+            if (sameNode)
+            {
+                order[i].sameNode = order[i].victims.size();
+            }
+        }
+    }
+    return order;
+}
+
+#endif //THREAD_POOLS_THREAD_PLACEMENT_H
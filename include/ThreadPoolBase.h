@@ -0,0 +1,88 @@
+#ifndef THREAD_POOLS_THREAD_POOL_BASE_H
+#define THREAD_POOLS_THREAD_POOL_BASE_H
+
+#include <future>
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+
+#include "FunctionWrapper.h"
+#include "TaskFuture.h"
+#include "Coroutine.h"
+
+// The submission calls every pool offers the same way, written once on top of
+// the pool's own Post(function) and EnqueBatch(std::vector<FunctionWrapper>&).
+// A pool derives from ThreadPoolBase<itself> and, if EnqueBatch() is private,
+// befriends it.
+template<typename Pool>
+class ThreadPoolBase
+{
+public:
+    // Same as Submit(), but the result goes through a TaskFuture whose shared
+    // state is recycled instead of the one of a std::packaged_task.
+    template<typename FunctionType>
+    TaskFuture<typename std::result_of<FunctionType()>::type>
+    Async(FunctionType function)
+    {
+        typedef typename std::result_of<FunctionType()>::type resultType;
+        TaskPromise<resultType> promise;
+        TaskFuture<resultType> result(promise.GetFuture());
+        Self().Post([promise = std::move(promise), function = std::move(function)]() mutable
+        {
+            promise.Fulfill(function);
+        });
+        return result;
+    }
+
+    // Hands the whole range [first, last) of callables over with one queue
+    // operation and one wake-up. The callables are copied out of the range.
+    template<typename Iterator>
+    std::vector<std::future<typename std::result_of<typename std::iterator_traits<Iterator>::value_type()>::type>>
+    SubmitBatch(Iterator first, Iterator last)
+    {
+        typedef typename std::iterator_traits<Iterator>::value_type functionType;
+        typedef typename std::result_of<functionType()>::type resultType;
+        std::vector<std::future<resultType>> results;
+        std::vector<FunctionWrapper> tasks;
+        for (; first != last; ++first)
+        {
+            std::packaged_task<resultType()> task(*first);
+            results.push_back(task.get_future());
+            tasks.emplace_back(std::move(task));
+        }
+        Self().EnqueBatch(tasks);
+        return results;
+    }
+
+    template<typename Iterator>
+    void PostBatch(Iterator first, Iterator last)
+    {
+        std::vector<FunctionWrapper> tasks;
+        for (; first != last; ++first)
+        {
+            tasks.emplace_back(*first);
+        }
+        Self().EnqueBatch(tasks);
+    }
+
+#ifdef THREAD_POOLS_COROUTINES
+    // co_await pool.Schedule() continues the coroutine on a worker of the pool.
+    ScheduleOperation<Pool> Schedule()
+    {
+        return ScheduleOperation<Pool>(Self());
+    }
+#endif //THREAD_POOLS_COROUTINES
+
+protected:
+    ThreadPoolBase() = default;
+    ~ThreadPoolBase() = default;
+
+private:
+    Pool& Self()
+    {
+        return static_cast<Pool&>(*this);
+    }
+};
+
+#endif //THREAD_POOLS_THREAD_POOL_BASE_H
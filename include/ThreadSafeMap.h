@@ -0,0 +1,631 @@
+#ifndef THREAD_POOLS_THREAD_SAFE_MAP_H
+#define THREAD_POOLS_THREAD_SAFE_MAP_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+#include <utility>
+#include <optional>
+#include <functional>
+#include <shared_mutex>
+
+#include "ParallelAlgorithms.h"
+
+// Hash map with lock striping: bucket b is guarded by the shared_mutex of stripe
+// (b % stripe count), so readers share a stripe and writers of different
+// stripes never meet. Bucket and stripe counts are powers of two and the
+// bucket count is never below the stripe count, so a key maps to the same
+// stripe in every table size.
+//
+// Growing does not stop the world. The new bucket array is allocated outside
+// the locks and only published under all stripes for a moment; after that every
+// write operation moves a few old buckets over, each under its own stripe lock.
+// Until a bucket has moved, lookups simply look in the old table. Reserve()
+// moves the buckets in parallel chunks on a pool instead.
+//
+// The bulk operations take a pool with the ParallelFor() interface, i.e.
+// StaticThreadPoolWithWorkingStealing.
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class ThreadSafeMap
+{
+    struct Node
+    {
+        Node(std::size_t t_hash, Key t_key, Value t_value)
+                :
+                hash(t_hash),
+                key(std::move(t_key)),
+                value(std::move(t_value))
+        {}
+
+        std::size_t hash;
+        Key key;
+        Value value;
+        Node* next = nullptr;
+    };
+
+    struct Bucket
+    {
+        Node* head = nullptr;
+        bool migrated = false;
+    };
+
+    struct Table
+    {
+        explicit Table(std::size_t t_bucketCount)
+                :
+                buckets(t_bucketCount),
+                mask(t_bucketCount - 1)
+        {}
+
+        ~Table()
+        {
+            for (Bucket& bucket : buckets)
+            {
+                while (bucket.head)
+                {
+                    delete std::exchange(bucket.head, bucket.head->next);
+                }
+            }
+        }
+
+        std::vector<Bucket> buckets;
+        std::size_t mask;
+    };
+
+    struct alignas(64) Stripe
+    {
+        mutable std::shared_mutex mutex;
+        std::size_t size = 0;
+    };
+
+    static constexpr std::size_t MigrationBatch = 4;
+
+public:
+    explicit ThreadSafeMap(std::size_t t_bucketCount = 64, std::size_t t_stripeCount = 0,
+                           const Hash& t_hash = Hash(), const KeyEqual& t_equal = KeyEqual())
+            :
+            m_stripeCount(RoundUpToPowerOfTwo(t_stripeCount != 0 ? t_stripeCount : DefaultStripeCount())),
+            m_stripes(new Stripe[m_stripeCount]),
+            m_table(new Table(RoundUpToPowerOfTwo(std::max(t_bucketCount, m_stripeCount)))),
+            m_hash(t_hash),
+            m_equal(t_equal)
+    {}
+
+    ~ThreadSafeMap()
+    {
+        delete m_table;
+        delete m_next;
+    }
+
+    ThreadSafeMap(const ThreadSafeMap&) = delete;
+    ThreadSafeMap& operator=(const ThreadSafeMap&) = delete;
+    ThreadSafeMap(ThreadSafeMap&&) = delete;
+    ThreadSafeMap& operator=(ThreadSafeMap&&) = delete;
+
+    std::optional<Value> Find(const Key& t_key) const
+    {
+        const std::size_t hash = m_hash(t_key);
+        std::shared_lock<std::shared_mutex> lock(StripeFor(hash).mutex);
+        if (const Node* node = FindNode(BucketFor(hash), hash, t_key))
+        {
+            return node->value;
+        }
+        return std::nullopt;
+    }
+
+    bool Contains(const Key& t_key) const
+    {
+        const std::size_t hash = m_hash(t_key);
+        std::shared_lock<std::shared_mutex> lock(StripeFor(hash).mutex);
+        return FindNode(BucketFor(hash), hash, t_key) != nullptr;
+    }
+
+    // Returns true if the key was not there before.
+    bool InsertOrAssign(Key t_key, Value t_value)
+    {
+        return Upsert(std::move(t_key), [&t_value](Value& t_current)
+        {
+            t_current = std::move(t_value);
+        });
+    }
+
+    // Calls t_function(value) under the stripe's exclusive lock; a missing key is
+    // inserted with a default constructed value first. Returns true if inserted.
+    template<typename Function>
+    bool Upsert(Key t_key, Function&& t_function)
+    {
+        const std::size_t hash = m_hash(t_key);
+        bool inserted = false;
+        bool grow = false;
+        {
+            Stripe& stripe = StripeFor(hash);
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            Bucket& bucket = BucketFor(hash);
+            Node* node = FindNode(bucket, hash, t_key);
+            if (!node)
+            {
+                node = Link(bucket, new Node(hash, std::move(t_key), Value()));
+                grow = Grew(stripe);
+                inserted = true;
+            }
+            t_function(node->value);
+        }
+        AfterWrite(grow);
+        return inserted;
+    }
+
+    // Returns the value for t_key, inserting t_factory() if it is missing. The
+    // factory runs under the stripe's exclusive lock.
+    template<typename Factory>
+    Value ComputeIfAbsent(const Key& t_key, Factory&& t_factory)
+    {
+        const std::size_t hash = m_hash(t_key);
+        Stripe& stripe = StripeFor(hash);
+        {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            if (const Node* node = FindNode(BucketFor(hash), hash, t_key))
+            {
+                return node->value;
+            }
+        }
+
+        std::optional<Value> result;
+        bool grow = false;
+        {
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            Bucket& bucket = BucketFor(hash);
+            Node* node = FindNode(bucket, hash, t_key);
+            if (!node)
+            {
+                node = Link(bucket, new Node(hash, t_key, t_factory()));
+                grow = Grew(stripe);
+            }
+            result.emplace(node->value);
+        }
+        AfterWrite(grow);
+        return std::move(*result);
+    }
+
+    bool Erase(const Key& t_key)
+    {
+        const std::size_t hash = m_hash(t_key);
+        bool erased = false;
+        {
+            Stripe& stripe = StripeFor(hash);
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            Bucket& bucket = BucketFor(hash);
+            for (Node** link = &bucket.head; *link; link = &(*link)->next)
+            {
+                Node* node = *link;
+                if (node->hash == hash && m_equal(node->key, t_key))
+                {
+                    *link = node->next;
+                    delete node;
+                    --stripe.size;
+                    erased = true;
+                    break;
+                }
+            }
+        }
+        AfterWrite(false);
+        return erased;
+    }
+
+    // Sums the stripes one after another, so under concurrent writes it is only
+    // a snapshot of each stripe at a slightly different time.
+    std::size_t Size() const
+    {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < m_stripeCount; ++i)
+        {
+            std::shared_lock<std::shared_mutex> lock(m_stripes[i].mutex);
+            size += m_stripes[i].size;
+        }
+        return size;
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+    std::size_t StripeCount() const
+    {
+        return m_stripeCount;
+    }
+
+    // May be called while other threads use the map; they see the new value
+    // from their next insert on.
+    void SetMaxLoadFactor(float t_maxLoadFactor)
+    {
+        m_maxLoadFactor.store(t_maxLoadFactor, std::memory_order_relaxed);
+    }
+
+    // Grows the table so that t_count entries fit under the max load factor. The
+    // old buckets are moved in parallel chunks on t_pool while the map stays in
+    // use; a resize that is already running is finished first.
+    template<typename Pool>
+    void Reserve(Pool& t_pool, std::size_t t_count)
+    {
+        const float maxLoadFactor = m_maxLoadFactor.load(std::memory_order_relaxed);
+        const auto wanted = static_cast<std::size_t>(std::ceil(static_cast<double>(t_count) / maxLoadFactor));
+        const std::size_t bucketCount = RoundUpToPowerOfTwo(std::max<std::size_t>(wanted, 1));
+        while (true)
+        {
+            if (m_resizing.load(std::memory_order_acquire))
+            {
+                if (!MigrateAll(t_pool))
+                {
+                    std::this_thread::yield();
+                }
+            }
+            else if (!StartResize(bucketCount))
+            {
+                return;
+            }
+        }
+    }
+
+    // InsertOrAssign() of every pair in [t_first, t_last), spread over t_pool
+    // after the table has been grown once for all of them. Returns how many keys
+    // were new.
+    template<typename Pool, typename RandomIt>
+    std::size_t BulkInsert(Pool& t_pool, RandomIt t_first, RandomIt t_last)
+    {
+        const auto count = static_cast<std::size_t>(std::distance(t_first, t_last));
+        Reserve(t_pool, Size() + count);
+        return ParallelReduce(t_pool, BlockedRange<std::size_t>(0, count), std::size_t(0),
+                              [this, t_first](const BlockedRange<std::size_t>& t_range, std::size_t t_inserted)
+        {
+            for (std::size_t i = t_range.begin(); i < t_range.end(); ++i)
+            {
+                const auto& entry = t_first[static_cast<typename std::iterator_traits<RandomIt>::difference_type>(i)];
+                if (InsertOrAssign(entry.first, entry.second))
+                {
+                    ++t_inserted;
+                }
+            }
+            return t_inserted;
+        }, std::plus<std::size_t>());
+    }
+
+    // Calls t_function(key, value) for every entry from t_pool's workers, so it
+    // must be safe to call concurrently. The buckets are visited a group at a
+    // time under the group's stripe shared lock (see VisitGroup()); a writer
+    // waits for one group at most. An entry that is not written during the walk
+    // is seen exactly once, even if the table grows meanwhile.
+    template<typename Pool, typename Function>
+    void ParallelForEach(Pool& t_pool, Function t_function) const
+    {
+        const std::size_t groupCount = GroupCount();
+        ParallelFor(t_pool, BlockedRange<std::size_t>(0, groupCount),
+                    [this, groupCount, &t_function](const BlockedRange<std::size_t>& t_range)
+        {
+            for (std::size_t group = t_range.begin(); group < t_range.end(); ++group)
+            {
+                VisitGroup(group, groupCount, t_function);
+            }
+        });
+    }
+
+    // A copy of the entries, taken a bucket group at a time like
+    // ParallelForEach(): every group is consistent on its own, but writers are
+    // never held up for the whole copy, so the groups are from slightly
+    // different moments.
+    std::vector<std::pair<Key, Value>> Snapshot() const
+    {
+        std::vector<std::pair<Key, Value>> entries;
+        auto copy = [&entries](const Key& t_key, const Value& t_value)
+        {
+            entries.emplace_back(t_key, t_value);
+        };
+
+        const std::size_t groupCount = GroupCount();
+        for (std::size_t group = 0; group < groupCount; ++group)
+        {
+            VisitGroup(group, groupCount, copy);
+        }
+        return entries;
+    }
+
+    // The same, with the groups copied in parallel on t_pool.
+    template<typename Pool>
+    std::vector<std::pair<Key, Value>> Snapshot(Pool& t_pool) const
+    {
+        typedef std::vector<std::pair<Key, Value>> Entries;
+        const std::size_t groupCount = GroupCount();
+        return ParallelReduce(t_pool, BlockedRange<std::size_t>(0, groupCount), Entries(),
+                              [this, groupCount](const BlockedRange<std::size_t>& t_range, Entries t_entries)
+        {
+            auto copy = [&t_entries](const Key& t_key, const Value& t_value)
+            {
+                t_entries.emplace_back(t_key, t_value);
+            };
+            for (std::size_t group = t_range.begin(); group < t_range.end(); ++group)
+            {
+                VisitGroup(group, groupCount, copy);
+            }
+            return t_entries;
+        }, [](Entries t_left, Entries t_right)
+        {
+            t_left.insert(t_left.end(), std::make_move_iterator(t_right.begin()),
+                          std::make_move_iterator(t_right.end()));
+            return t_left;
+        });
+    }
+
+private:
+    Stripe& StripeFor(std::size_t t_hash) const
+    {
+        return m_stripes[t_hash & (m_stripeCount - 1)];
+    }
+
+    // Caller holds the key's stripe, which pins m_table and m_next.
+    Bucket& BucketFor(std::size_t t_hash) const
+    {
+        Bucket& bucket = m_table->buckets[t_hash & m_table->mask];
+        if (m_next && bucket.migrated)
+        {
+            return m_next->buckets[t_hash & m_next->mask];
+        }
+        return bucket;
+    }
+
+    Node* FindNode(const Bucket& t_bucket, std::size_t t_hash, const Key& t_key) const
+    {
+        for (Node* node = t_bucket.head; node; node = node->next)
+        {
+            if (node->hash == t_hash && m_equal(node->key, t_key))
+            {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    static Node* Link(Bucket& t_bucket, Node* t_node)
+    {
+        t_node->next = t_bucket.head;
+        t_bucket.head = t_node;
+        return t_node;
+    }
+
+    // Caller holds t_stripe exclusively.
+    bool Grew(Stripe& t_stripe)
+    {
+        ++t_stripe.size;
+        const std::size_t bucketCount = (m_next ? m_next : m_table)->buckets.size();
+        return !m_next && t_stripe.size * m_stripeCount > bucketCount * m_maxLoadFactor.load(std::memory_order_relaxed);
+    }
+
+    // The bucket count when a walk starts. Tables only grow, so every key with
+    // (hash & (groupCount - 1)) == g stays in the buckets of group g however
+    // often the table grows during the walk.
+    std::size_t GroupCount() const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_stripes[0].mutex);
+        return m_table->buckets.size();
+    }
+
+    // Group t_group is the old buckets t_group, t_group + t_groupCount, ... and,
+    // for those already moved, their buckets in m_next. They all belong to one
+    // stripe, so one shared lock pins the whole group.
+    template<typename Function>
+    void VisitGroup(std::size_t t_group, std::size_t t_groupCount, Function& t_function) const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_stripes[t_group & (m_stripeCount - 1)].mutex);
+        const std::size_t bucketCount = m_table->buckets.size();
+        for (std::size_t index = t_group; index < bucketCount; index += t_groupCount)
+        {
+            const Bucket& bucket = m_table->buckets[index];
+            if (!m_next || !bucket.migrated)
+            {
+                VisitBucket(bucket, t_function);
+                continue;
+            }
+            for (std::size_t moved = index; moved < m_next->buckets.size(); moved += bucketCount)
+            {
+                VisitBucket(m_next->buckets[moved], t_function);
+            }
+        }
+    }
+
+    template<typename Function>
+    static void VisitBucket(const Bucket& t_bucket, Function& t_function)
+    {
+        for (const Node* node = t_bucket.head; node; node = node->next)
+        {
+            t_function(node->key, node->value);
+        }
+    }
+
+    void AfterWrite(bool t_grow)
+    {
+        if (t_grow)
+        {
+            StartResize(0);
+        }
+        if (m_resizing.load(std::memory_order_acquire))
+        {
+            MigrateSome(MigrationBatch);
+        }
+    }
+
+    // Starts moving to a table of t_bucketCount buckets (0 doubles the current
+    // one). Returns false if the table is that big already, true if a resize is
+    // running now, whether this call started it or another one did.
+    bool StartResize(std::size_t t_bucketCount)
+    {
+        bool expected = false;
+        if (!m_resizing.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+        {
+            return true;
+        }
+
+        // Only the thread that owns m_resizing replaces m_table.
+        const std::size_t current = m_table->buckets.size();
+        const std::size_t bucketCount = t_bucketCount != 0 ? t_bucketCount : current * 2;
+        if (bucketCount <= current)
+        {
+            m_resizing.store(false, std::memory_order_release);
+            return false;
+        }
+
+        Table* next = nullptr;
+        try
+        {
+            next = new Table(bucketCount);
+        }
+        catch (...)
+        {
+            m_resizing.store(false, std::memory_order_release);
+            throw;
+        }
+
+        LockAll();
+        m_next = next;
+        m_migrateCursor.store(0, std::memory_order_relaxed);
+        m_migrated.store(0, std::memory_order_relaxed);
+        UnlockAll();
+        return true;
+    }
+
+    void MigrateSome(std::size_t t_count)
+    {
+        const std::size_t first = m_migrateCursor.fetch_add(t_count, std::memory_order_relaxed);
+        MigrateRange(first, first + t_count);
+    }
+
+    // Moves the old buckets in [t_first, t_last) that are still there to the new
+    // table, each under its own stripe lock; the thread that moves the last one
+    // swaps the tables. Stops early once the resize it started in is over, so
+    // that it never counts buckets of one resize towards the next.
+    void MigrateRange(std::size_t t_first, std::size_t t_last)
+    {
+        const Table* table = nullptr;
+        std::size_t moved = 0;
+        std::size_t bucketCount = 0;
+
+        for (std::size_t index = t_first; index < t_last; ++index)
+        {
+            std::unique_lock<std::shared_mutex> lock(m_stripes[index & (m_stripeCount - 1)].mutex);
+            if (!m_next || index >= m_table->buckets.size() || (table && table != m_table))
+            {
+                break;
+            }
+
+            table = m_table;
+            bucketCount = m_table->buckets.size();
+            Bucket& bucket = m_table->buckets[index];
+            if (bucket.migrated)
+            {
+                continue;
+            }
+
+            while (bucket.head)
+            {
+                Node* node = std::exchange(bucket.head, bucket.head->next);
+                Link(m_next->buckets[node->hash & m_next->mask], node);
+            }
+            bucket.migrated = true;
+            ++moved;
+        }
+
+        if (moved != 0 &&
+            m_migrated.fetch_add(moved, std::memory_order_acq_rel) + moved == bucketCount)
+        {
+            FinishResize();
+        }
+    }
+
+    // Helps the running resize along with every worker of t_pool. Returns false
+    // if there was nothing to move: the new table is not there yet, or all
+    // buckets have moved and the tables are about to be swapped.
+    template<typename Pool>
+    bool MigrateAll(Pool& t_pool)
+    {
+        std::size_t bucketCount = 0;
+        {
+            std::shared_lock<std::shared_mutex> lock(m_stripes[0].mutex);
+            if (!m_next)
+            {
+                return false;
+            }
+            bucketCount = m_table->buckets.size();
+        }
+        if (m_migrated.load(std::memory_order_acquire) == bucketCount)
+        {
+            return false;
+        }
+
+        ParallelFor(t_pool, BlockedRange<std::size_t>(0, bucketCount), [this](const BlockedRange<std::size_t>& t_range)
+        {
+            MigrateRange(t_range.begin(), t_range.end());
+        });
+        return true;
+    }
+
+    // The old table is freed outside the locks; it is empty by now, but a big
+    // one still takes a while to walk.
+    void FinishResize()
+    {
+        LockAll();
+        Table* old = m_table;
+        m_table = std::exchange(m_next, nullptr);
+        UnlockAll();
+        m_resizing.store(false, std::memory_order_release);
+        delete old;
+    }
+
+    void LockAll()
+    {
+        for (std::size_t i = 0; i < m_stripeCount; ++i)
+        {
+            m_stripes[i].mutex.lock();
+        }
+    }
+
+    void UnlockAll()
+    {
+        for (std::size_t i = m_stripeCount; i > 0; --i)
+        {
+            m_stripes[i - 1].mutex.unlock();
+        }
+    }
+
+    static std::size_t DefaultStripeCount()
+    {
+        const std::size_t threads = std::thread::hardware_concurrency();
+        return std::max<std::size_t>(16, threads * 8);
+    }
+
+    static std::size_t RoundUpToPowerOfTwo(std::size_t t_value)
+    {
+        std::size_t result = 1;
+        while (result < t_value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+private:
+    const std::size_t m_stripeCount;
+    std::unique_ptr<Stripe[]> m_stripes;
+    Table* m_table;
+    Table* m_next = nullptr;
+    std::atomic_bool m_resizing{false};
+    std::atomic<std::size_t> m_migrateCursor{0};
+    std::atomic<std::size_t> m_migrated{0};
+    std::atomic<float> m_maxLoadFactor{1.0f};
+    Hash m_hash;
+    KeyEqual m_equal;
+};
+
+#endif //THREAD_POOLS_THREAD_SAFE_MAP_H
@@ -2,9 +2,8 @@
 #define THREAD_SAFE_QUEUE_H
 
 #include <mutex>
-#include <condition_variable>
-#include <thread>
-#include <deque>
+
+#include "RingBuffer.h"
 
 template<class T>
 class ThreadSafeQueue
@@ -19,28 +18,55 @@ public:
 
     void Enque(T&& val)
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffer.PushBack(std::move(val));
+    }
+
+    // Never full; here for pools that may also run on a BoundedQueue.
+    bool TryEnque(T&& val)
+    {
+        Enque(std::move(val));
+        return true;
+    }
+
+    // Moves the whole range in under a single lock acquisition.
+    template<typename Iterator>
+    void EnqueBulk(Iterator first, Iterator last)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (; first != last; ++first)
         {
-            std::unique_lock lock(m_mutex);
-            m_buffer.push_front(std::move(val));
+            m_buffer.PushBack(std::move(*first));
         }
-        m_not_empty.notify_one();
+    }
+
+    template<typename Iterator>
+    Iterator TryEnqueBulk(Iterator first, Iterator last)
+    {
+        EnqueBulk(first, last);
+        return last;
     }
 
     bool TryDeque(T& val)
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_buffer.empty())
+        if (m_buffer.Empty())
         {
             return false;
         }
-        val = std::move(m_buffer.back());
-        m_buffer.pop_back();
+        val = std::move(m_buffer.Front());
+        m_buffer.PopFront();
         return true;
     }
 
+    std::size_t Size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_buffer.Size();
+    }
+
 private:
-    std::deque<T> m_buffer;
-    std::condition_variable m_not_empty;
+    RingBuffer<T> m_buffer;
     mutable std::mutex m_mutex;
 };
 #endif //THREAD_SAFE_QUEUE_H
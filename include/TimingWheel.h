@@ -0,0 +1,504 @@
+#ifndef THREAD_POOLS_TIMING_WHEEL_H
+#define THREAD_POOLS_TIMING_WHEEL_H
+
+#include <mutex>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <condition_variable>
+
+#include "FunctionWrapper.h"
+
+class TimingWheel;
+
+// Refers to one scheduled task. Copies refer to the same task. Cancel() after
+// the task has run (or was cancelled) just returns false. A handle must not be
+// used after its pool is gone.
+class TimerHandle
+{
+public:
+    TimerHandle() = default;
+
+    bool Cancel();
+
+private:
+    friend class TimingWheel;
+
+    TimerHandle(TimingWheel* t_wheel, void* t_timer, uint32_t t_generation)
+            :
+            m_wheel(t_wheel),
+            m_timer(t_timer),
+            m_generation(t_generation)
+    {}
+
+    TimingWheel* m_wheel = nullptr;
+    void* m_timer = nullptr;
+    uint32_t m_generation = 0;
+};
+
+// Hierarchical timing wheel after Varghese and Lauck, with a resolution of one
+// millisecond. Four levels of 256 slots cover 2^32 ticks (about 49 days); a
+// timer further out sits in the last slot it can reach and is put back when it
+// gets there. Each slot is an intrusive list, so scheduling and cancelling are
+// O(1) under one mutex. Every 256 ticks the next slot of the level above is
+// cascaded down one level.
+//
+// Timers live in chunks that are recycled through a free list, so memory stays
+// at the peak number of pending timers. A thread, started by the first
+// Schedule(), sleeps until the next non-empty slot and hands the expired tasks
+// to t_sink outside the lock; the pools pass their Post(). A periodic task is
+// put back only after its run has finished, so runs never overlap; runs that
+// were missed meanwhile are skipped.
+class TimingWheel
+{
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::milliseconds tick_duration;
+
+    static constexpr std::size_t LevelBits = 8;
+    static constexpr std::size_t SlotCount = std::size_t(1) << LevelBits;
+    static constexpr std::size_t LevelCount = 4;
+    static constexpr uint64_t SlotMask = SlotCount - 1;
+    static constexpr uint64_t MaxDelta = (uint64_t(1) << (LevelBits * LevelCount)) - 1;
+    static constexpr std::size_t ChunkSize = 1024;
+
+    enum class State : uint8_t
+    {
+        Free,
+        Armed,
+        Running,
+        Cancelled
+    };
+
+    struct Link
+    {
+        Link* prev = nullptr;
+        Link* next = nullptr;
+    };
+
+    struct Timer : Link
+    {
+        uint64_t expiry = 0;
+        uint64_t period = 0;
+        uint32_t generation = 0;
+        State state = State::Free;
+        FunctionWrapper task;
+    };
+
+    // Circular list with a sentinel head.
+    struct Slot
+    {
+        Link head;
+
+        Slot()
+        {
+            head.prev = &head;
+            head.next = &head;
+        }
+
+        bool Empty() const
+        {
+            return head.next == &head;
+        }
+    };
+
+public:
+    typedef std::function<void(FunctionWrapper&&)> sink_type;
+
+    explicit TimingWheel(sink_type t_sink)
+            :
+            m_sink(std::move(t_sink)),
+            m_start(clock::now())
+    {}
+
+    ~TimingWheel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_one();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+    TimingWheel(TimingWheel&&) = delete;
+    TimingWheel& operator=(TimingWheel&&) = delete;
+
+    template<typename FunctionType, typename Rep, typename Period>
+    TimerHandle ScheduleAfter(const std::chrono::duration<Rep, Period>& t_delay, FunctionType function)
+    {
+        return Schedule(clock::now() + std::chrono::ceil<clock::duration>(t_delay), 0,
+                        FunctionWrapper(std::move(function)));
+    }
+
+    template<typename FunctionType, typename Clock, typename Duration>
+    TimerHandle ScheduleAt(const std::chrono::time_point<Clock, Duration>& t_time, FunctionType function)
+    {
+        return ScheduleAfter(t_time - Clock::now(), std::move(function));
+    }
+
+    // First run after one period, then every period.
+    template<typename FunctionType, typename Rep, typename Period>
+    TimerHandle ScheduleEvery(const std::chrono::duration<Rep, Period>& t_period, FunctionType function)
+    {
+        const uint64_t period = std::max<uint64_t>(1, std::chrono::ceil<tick_duration>(t_period).count());
+        return Schedule(clock::now() + std::chrono::ceil<clock::duration>(t_period), period,
+                        FunctionWrapper(std::move(function)));
+    }
+
+    std::size_t Pending()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending;
+    }
+
+private:
+    friend class TimerHandle;
+
+    TimerHandle Schedule(clock::time_point t_time, uint64_t t_period, FunctionWrapper t_task)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        SkipIdleTicks();
+        Timer* timer = Allocate();
+        timer->expiry = TickAt(t_time);
+        timer->period = t_period;
+        timer->task = std::move(t_task);
+        Arm(timer);
+
+        if (!m_thread.joinable())
+        {
+            m_thread = std::thread(&TimingWheel::Run, this);
+        }
+        else if (timer->expiry < m_sleepUntil)
+        {
+            m_wakeup.notify_one();
+        }
+        return TimerHandle(this, timer, timer->generation);
+    }
+
+    bool Cancel(void* t_timer, uint32_t t_generation)
+    {
+        FunctionWrapper task;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Timer* timer = static_cast<Timer*>(t_timer);
+        if (timer->generation != t_generation)
+        {
+            return false;
+        }
+        if (timer->state == State::Armed)
+        {
+            Unlink(timer);
+            --m_pending;
+            task = Release(timer);
+            return true;
+        }
+        if (timer->state == State::Running)
+        {
+            timer->state = State::Cancelled;
+            return true;
+        }
+        return false;
+    }
+
+    uint64_t TickAt(clock::time_point t_time) const
+    {
+        if (t_time <= m_start)
+        {
+            return 0;
+        }
+        return static_cast<uint64_t>(std::chrono::ceil<tick_duration>(t_time - m_start).count());
+    }
+
+    // The last tick that has fully elapsed.
+    uint64_t CurrentTick() const
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<tick_duration>(clock::now() - m_start).count());
+    }
+
+    clock::time_point TimeOf(uint64_t t_tick) const
+    {
+        return m_start + tick_duration(t_tick);
+    }
+
+    // With nothing armed every slot is empty, so m_now can jump to the present
+    // instead of the thread walking every tick it slept through.
+    void SkipIdleTicks()
+    {
+        if (m_pending == 0)
+        {
+            m_now = std::max(m_now, CurrentTick());
+        }
+    }
+
+    Timer* Allocate()
+    {
+        if (!m_free)
+        {
+            m_chunks.push_back(std::make_unique<Timer[]>(ChunkSize));
+            Timer* chunk = m_chunks.back().get();
+            for (std::size_t i = 0; i < ChunkSize; ++i)
+            {
+                chunk[i].next = m_free;
+                m_free = &chunk[i];
+            }
+        }
+        Timer* timer = static_cast<Timer*>(m_free);
+        m_free = timer->next;
+        return timer;
+    }
+
+    // The task is handed back so that it is destroyed outside the lock.
+    FunctionWrapper Release(Timer* t_timer)
+    {
+        FunctionWrapper task(std::move(t_timer->task));
+        ++t_timer->generation;
+        t_timer->state = State::Free;
+        t_timer->next = m_free;
+        m_free = t_timer;
+        return task;
+    }
+
+    // Level and slot follow from the distance to m_now and the expiry bits.
+    void Arm(Timer* t_timer)
+    {
+        const uint64_t expiry = std::max(t_timer->expiry, m_now);
+        const uint64_t slotTick = std::min(expiry, m_now + MaxDelta);
+        const uint64_t delta = slotTick - m_now;
+        std::size_t level = 0;
+        while (level + 1 < LevelCount && delta >> (LevelBits * (level + 1)) != 0)
+        {
+            ++level;
+        }
+        Slot& slot = m_levels[level][(slotTick >> (LevelBits * level)) & SlotMask];
+
+        t_timer->state = State::Armed;
+        t_timer->prev = slot.head.prev;
+        t_timer->next = &slot.head;
+        slot.head.prev->next = t_timer;
+        slot.head.prev = t_timer;
+        ++m_pending;
+    }
+
+    static void Unlink(Timer* t_timer)
+    {
+        t_timer->prev->next = t_timer->next;
+        t_timer->next->prev = t_timer->prev;
+    }
+
+    // Takes every timer out of t_slot and returns the first of a singly linked list.
+    Timer* Detach(Slot& t_slot)
+    {
+        if (t_slot.Empty())
+        {
+            return nullptr;
+        }
+        Timer* first = static_cast<Timer*>(t_slot.head.next);
+        t_slot.head.prev->next = nullptr;
+        t_slot.head.prev = &t_slot.head;
+        t_slot.head.next = &t_slot.head;
+        return first;
+    }
+
+    // Processes tick m_now and moves on to the next one.
+    void Advance(std::vector<FunctionWrapper>& t_fired)
+    {
+        for (std::size_t level = 1; level < LevelCount; ++level)
+        {
+            if ((m_now >> (LevelBits * (level - 1))) & SlotMask)
+            {
+                break;
+            }
+            Timer* timer = Detach(m_levels[level][(m_now >> (LevelBits * level)) & SlotMask]);
+            while (timer)
+            {
+                Timer* next = static_cast<Timer*>(timer->next);
+                --m_pending;
+                Arm(timer);
+                timer = next;
+            }
+        }
+
+        Timer* timer = Detach(m_levels[0][m_now & SlotMask]);
+        while (timer)
+        {
+            Timer* next = static_cast<Timer*>(timer->next);
+            --m_pending;
+            if (timer->expiry > m_now)
+            {
+                Arm(timer);
+            }
+            else if (timer->period == 0)
+            {
+                t_fired.push_back(Release(timer));
+            }
+            else
+            {
+                timer->state = State::Running;
+                t_fired.emplace_back([this, timer, generation = timer->generation]()
+                {
+                    RunPeriodic(timer, generation);
+                });
+            }
+            timer = next;
+        }
+        ++m_now;
+    }
+
+    void RunPeriodic(Timer* t_timer, uint32_t t_generation)
+    {
+        t_timer->task();
+
+        FunctionWrapper task;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (t_timer->generation != t_generation || m_stop)
+        {
+            return;
+        }
+        if (t_timer->state == State::Cancelled)
+        {
+            task = Release(t_timer);
+            return;
+        }
+        SkipIdleTicks();
+        t_timer->expiry += t_timer->period;
+        if (t_timer->expiry < m_now)
+        {
+            t_timer->expiry += (m_now - t_timer->expiry + t_timer->period - 1) / t_timer->period * t_timer->period;
+        }
+        Arm(t_timer);
+        if (t_timer->expiry < m_sleepUntil)
+        {
+            m_wakeup.notify_one();
+        }
+    }
+
+    // The tick the thread has to be awake for: the next non-empty slot of the
+    // lowest level or the next cascade, whichever comes first.
+    uint64_t NextEventTick() const
+    {
+        const uint64_t boundary = (m_now | SlotMask) + 1;
+        if ((m_now & SlotMask) == 0)
+        {
+            return m_now;
+        }
+        for (uint64_t tick = m_now; tick < boundary; ++tick)
+        {
+            if (!m_levels[0][tick & SlotMask].Empty())
+            {
+                return tick;
+            }
+        }
+        return boundary;
+    }
+
+    void Run()
+    {
+        std::vector<FunctionWrapper> fired;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stop)
+        {
+            const uint64_t elapsed = CurrentTick();
+            while (m_now <= elapsed && fired.size() < ChunkSize)
+            {
+                Advance(fired);
+            }
+
+            if (!fired.empty())
+            {
+                lock.unlock();
+                for (FunctionWrapper& task : fired)
+                {
+                    task.MarkEnqueued();
+                    m_sink(std::move(task));
+                }
+                fired.clear();
+                lock.lock();
+                continue;
+            }
+
+            if (m_pending == 0)
+            {
+                SkipIdleTicks();
+                m_sleepUntil = UINT64_MAX;
+                m_wakeup.wait(lock);
+            }
+            else
+            {
+                m_sleepUntil = NextEventTick();
+                m_wakeup.wait_until(lock, TimeOf(m_sleepUntil));
+            }
+            m_sleepUntil = 0;
+        }
+    }
+
+private:
+    const sink_type m_sink;
+    const clock::time_point m_start;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stop = false;
+    uint64_t m_now = 0;
+    uint64_t m_sleepUntil = 0;
+    std::size_t m_pending = 0;
+    std::array<std::array<Slot, SlotCount>, LevelCount> m_levels;
+    std::vector<std::unique_ptr<Timer[]>> m_chunks;
+    Link* m_free = nullptr;
+    std::thread m_thread;
+};
+
+inline bool TimerHandle::Cancel()
+{
+    return m_wheel && m_wheel->Cancel(m_timer, m_generation);
+}
+
+// The timer calls of the pools, forwarded to the pool's TimingWheel m_timers.
+// A pool derives from TimerScheduling<itself> and befriends it.
+template<typename Pool>
+class TimerScheduling
+{
+public:
+    // Runs function on a worker once t_delay has passed. Unlike sleeping in a
+    // task, the wait does not hold a worker.
+    template<typename FunctionType, typename Rep, typename Period>
+    TimerHandle ScheduleAfter(const std::chrono::duration<Rep, Period>& t_delay, FunctionType function)
+    {
+        return Timers().ScheduleAfter(t_delay, std::move(function));
+    }
+
+    template<typename FunctionType, typename Clock, typename Duration>
+    TimerHandle ScheduleAt(const std::chrono::time_point<Clock, Duration>& t_time, FunctionType function)
+    {
+        return Timers().ScheduleAt(t_time, std::move(function));
+    }
+
+    // Runs function every t_period until the handle is cancelled or the pool
+    // is destroyed. A run that would overlap the previous one is skipped.
+    template<typename FunctionType, typename Rep, typename Period>
+    TimerHandle ScheduleEvery(const std::chrono::duration<Rep, Period>& t_period, FunctionType function)
+    {
+        return Timers().ScheduleEvery(t_period, std::move(function));
+    }
+
+protected:
+    TimerScheduling() = default;
+    ~TimerScheduling() = default;
+
+private:
+    TimingWheel& Timers()
+    {
+        return static_cast<Pool&>(*this).m_timers;
+    }
+};
+
+#endif //THREAD_POOLS_TIMING_WHEEL_H
@@ -1,8 +1,11 @@
 #ifndef THREAD_POOLS_WORK_STEALING_QUEUE_H
 #define THREAD_POOLS_WORK_STEALING_QUEUE_H
 
-#include <deque>
 #include <mutex>
+#include <cstddef>
+#include <algorithm>
+
+#include "RingBuffer.h"
 
 template<typename T>
 class WorkStealingQueue
@@ -18,36 +21,68 @@ public:
     void Enque(T data)
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_buffer.push_front(std::move(data));
+        m_buffer.PushBack(std::move(data));
+    }
+
+    template<typename Iterator>
+    void EnqueBulk(Iterator first, Iterator last)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (; first != last; ++first)
+        {
+            m_buffer.PushBack(std::move(*first));
+        }
     }
 
     bool TryDeque(T& data)
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_buffer.empty())
+        if (m_buffer.Empty())
         {
             return false;
         }
 
-        data = std::move(m_buffer.front());
-        m_buffer.pop_front();
+        data = std::move(m_buffer.Back());
+        m_buffer.PopBack();
         return true;
     }
 
     bool TrySteal(T& data)
     {
         std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_buffer.empty())
+        if (m_buffer.Empty())
         {
             return false;
         }
-        data = std::move(m_buffer.back());
-        m_buffer.pop_back();
+        data = std::move(m_buffer.Front());
+        m_buffer.PopFront();
         return true;
     }
 
+    // Takes the older half of the elements, at most t_max, under one lock: the
+    // oldest goes to data, the others are appended to t_rest in queue order.
+    // Returns how many were taken.
+    template<typename Container>
+    std::size_t TryStealHalf(T& data, Container& t_rest, std::size_t t_max)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_buffer.Empty())
+        {
+            return 0;
+        }
+        const std::size_t count = std::max<std::size_t>(1, std::min(t_max, (m_buffer.Size() + 1) / 2));
+        data = std::move(m_buffer.Front());
+        m_buffer.PopFront();
+        for (std::size_t i = 1; i < count; ++i)
+        {
+            t_rest.push_back(std::move(m_buffer.Front()));
+            m_buffer.PopFront();
+        }
+        return count;
+    }
+
 private:
-    std::deque<T> m_buffer;
+    RingBuffer<T> m_buffer;
     mutable std::mutex m_mutex;
 };
 
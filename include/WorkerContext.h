@@ -0,0 +1,114 @@
+#ifndef THREAD_POOLS_WORKER_CONTEXT_H
+#define THREAD_POOLS_WORKER_CONTEXT_H
+
+#include <new>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <utility>
+
+// The per-worker state of one pool instance: a cache-line aligned slot per
+// worker in a single array, so that no two workers share a line. Each worker
+// builds its own slot once it has pinned itself, so whatever the slot
+// allocates lands on the worker's NUMA node.
+//
+// Current() tells a thread which worker it is. The thread_local behind it is
+// shared by all pools with the same Worker type, but a thread works for one
+// pool at most and the slot records which one, so a worker of one pool that
+// posts to another pool is not taken for a worker of that pool.
+template<typename Worker>
+class WorkerContexts
+{
+    struct alignas(64) Slot
+    {
+        template<typename... Args>
+        explicit Slot(const WorkerContexts* t_owner, Args&&... t_args)
+                :
+                owner(t_owner),
+                worker(std::forward<Args>(t_args)...)
+        {}
+
+        const WorkerContexts* const owner;
+        Worker worker;
+    };
+
+public:
+    explicit WorkerContexts(std::size_t t_count)
+            :
+            m_count(t_count),
+            m_slots(static_cast<Slot*>(::operator new(sizeof(Slot) * t_count, std::align_val_t(alignof(Slot))))),
+            m_built(new std::atomic_bool[t_count])
+    {
+        for (std::size_t i = 0; i < m_count; ++i)
+        {
+            m_built[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // The workers must have stopped by now.
+    ~WorkerContexts()
+    {
+        for (std::size_t i = 0; i < m_count; ++i)
+        {
+            if (m_built[i].load(std::memory_order_acquire))
+            {
+                m_slots[i].~Slot();
+            }
+        }
+        ::operator delete(m_slots, std::align_val_t(alignof(Slot)));
+    }
+
+    WorkerContexts(const WorkerContexts&) = delete;
+    WorkerContexts& operator=(const WorkerContexts&) = delete;
+    WorkerContexts(WorkerContexts&&) = delete;
+    WorkerContexts& operator=(WorkerContexts&&) = delete;
+
+    // Called by worker t_index on its own thread; from then on Current() on
+    // that thread returns the new worker.
+    template<typename... Args>
+    Worker& Emplace(std::size_t t_index, Args&&... t_args)
+    {
+        Slot* slot = ::new (&m_slots[t_index]) Slot(this, std::forward<Args>(t_args)...);
+        m_built[t_index].store(true, std::memory_order_release);
+        m_current = slot;
+        return slot->worker;
+    }
+
+    // The calling thread's worker, or nullptr if it is not one of ours.
+    Worker* Current() const
+    {
+        Slot* slot = m_current;
+        return slot && slot->owner == this ? &slot->worker : nullptr;
+    }
+
+    bool IsBuilt(std::size_t t_index) const
+    {
+        return m_built[t_index].load(std::memory_order_acquire);
+    }
+
+    Worker& operator[](std::size_t t_index)
+    {
+        return m_slots[t_index].worker;
+    }
+
+    const Worker& operator[](std::size_t t_index) const
+    {
+        return m_slots[t_index].worker;
+    }
+
+    std::size_t Size() const
+    {
+        return m_count;
+    }
+
+private:
+    const std::size_t m_count;
+    Slot* const m_slots;
+    const std::unique_ptr<std::atomic_bool[]> m_built;
+    static thread_local Slot* m_current;
+};
+
+template<typename Worker>
+thread_local typename WorkerContexts<Worker>::Slot* WorkerContexts<Worker>::m_current = nullptr;
+
+#endif //THREAD_POOLS_WORKER_CONTEXT_H
@@ -0,0 +1,329 @@
+#ifndef THREAD_POOLS_WORKER_STATS_H
+#define THREAD_POOLS_WORKER_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif //_MSC_VER
+
+// What the pools report through Stats(). Counters are only collected when the
+// pools are built with THREAD_POOL_STATS; otherwise every WorkerStats call is
+// empty and Stats() reports zeros.
+
+// Durations in HDR style: below 16 ns one bucket per nanosecond, above that 16
+// buckets per power of two, so a value is off by less than 1/16 across the
+// whole 64-bit range.
+class HistogramBuckets
+{
+public:
+    static constexpr std::size_t SubBucketBits = 4;
+    static constexpr std::size_t SubBuckets = std::size_t(1) << SubBucketBits;
+    static constexpr std::size_t Count = (64 - SubBucketBits + 1) * SubBuckets;
+
+    static std::size_t Index(uint64_t t_value)
+    {
+        if (t_value < SubBuckets)
+        {
+            return static_cast<std::size_t>(t_value);
+        }
+        const unsigned exponent = HighestBit(t_value);
+        const uint64_t subBucket = (t_value >> (exponent - SubBucketBits)) & (SubBuckets - 1);
+        return (exponent - SubBucketBits + 1) * SubBuckets + static_cast<std::size_t>(subBucket);
+    }
+
+    // The largest value that lands in bucket t_index.
+    static uint64_t UpperBound(std::size_t t_index)
+    {
+        if (t_index < SubBuckets)
+        {
+            return t_index;
+        }
+        const unsigned shift = static_cast<unsigned>(t_index / SubBuckets - 1);
+        const uint64_t lower = (SubBuckets + t_index % SubBuckets) << shift;
+        return lower + ((uint64_t(1) << shift) - 1);
+    }
+
+private:
+    static unsigned HighestBit(uint64_t t_value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, t_value);
+        return static_cast<unsigned>(index);
+#else
+        return 63 - static_cast<unsigned>(__builtin_clzll(t_value));
+#endif //_MSC_VER
+    }
+};
+
+struct HistogramSnapshot
+{
+    std::vector<uint64_t> counts;
+
+    uint64_t Count() const
+    {
+        uint64_t total = 0;
+        for (uint64_t count : counts)
+        {
+            total += count;
+        }
+        return total;
+    }
+
+    // t_percentile in [0, 100]; the result is the upper bound of its bucket.
+    std::chrono::nanoseconds Percentile(double t_percentile) const
+    {
+        const uint64_t total = Count();
+        if (total == 0)
+        {
+            return std::chrono::nanoseconds(0);
+        }
+        const double clamped = std::min(100.0, std::max(0.0, t_percentile));
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(clamped / 100.0 * static_cast<double>(total) + 0.5));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return std::chrono::nanoseconds(HistogramBuckets::UpperBound(i));
+            }
+        }
+        return Max();
+    }
+
+    std::chrono::nanoseconds Max() const
+    {
+        for (std::size_t i = counts.size(); i > 0; --i)
+        {
+            if (counts[i - 1] != 0)
+            {
+                return std::chrono::nanoseconds(HistogramBuckets::UpperBound(i - 1));
+            }
+        }
+        return std::chrono::nanoseconds(0);
+    }
+
+    void Merge(const HistogramSnapshot& t_other)
+    {
+        counts.resize(std::max(counts.size(), t_other.counts.size()));
+        for (std::size_t i = 0; i < t_other.counts.size(); ++i)
+        {
+            counts[i] += t_other.counts[i];
+        }
+    }
+};
+
+struct WorkerStatsSnapshot
+{
+    uint64_t executed = 0;
+    uint64_t localPops = 0;
+    uint64_t globalPops = 0;
+    uint64_t stolen = 0;
+    uint64_t failedSteals = 0;
+    uint64_t spins = 0;
+    uint64_t parks = 0;
+    std::chrono::nanoseconds parked{0};
+    // From the moment the task was handed to the pool until it started.
+    HistogramSnapshot queueWait;
+    HistogramSnapshot execution;
+
+    void Merge(const WorkerStatsSnapshot& t_other)
+    {
+        executed += t_other.executed;
+        localPops += t_other.localPops;
+        globalPops += t_other.globalPops;
+        stolen += t_other.stolen;
+        failedSteals += t_other.failedSteals;
+        spins += t_other.spins;
+        parks += t_other.parks;
+        parked += t_other.parked;
+        queueWait.Merge(t_other.queueWait);
+        execution.Merge(t_other.execution);
+    }
+};
+
+struct PoolStats
+{
+    std::vector<WorkerStatsSnapshot> workers;
+    // Tasks waiting in the shared queue(s) when the snapshot was taken.
+    std::size_t queuedTasks = 0;
+
+    WorkerStatsSnapshot Total() const
+    {
+        WorkerStatsSnapshot total;
+        for (const WorkerStatsSnapshot& worker : workers)
+        {
+            total.Merge(worker);
+        }
+        return total;
+    }
+};
+
+#ifdef THREAD_POOL_STATS
+
+// Only its own worker writes to it, so a relaxed load and store is enough for
+// a counter; Snapshot() may run on any thread and sees slightly stale values.
+class alignas(64) WorkerStats
+{
+    typedef std::chrono::steady_clock clock;
+
+    class Histogram
+    {
+    public:
+        void Record(clock::duration t_duration)
+        {
+            const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(t_duration).count();
+            Bump(m_counts[HistogramBuckets::Index(nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0)]);
+        }
+
+        HistogramSnapshot Snapshot() const
+        {
+            HistogramSnapshot snapshot;
+            snapshot.counts.resize(m_counts.size());
+            for (std::size_t i = 0; i < m_counts.size(); ++i)
+            {
+                snapshot.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+            }
+            return snapshot;
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, HistogramBuckets::Count> m_counts{};
+    };
+
+public:
+    void LocalPop()
+    {
+        Bump(m_localPops);
+    }
+
+    void GlobalPop()
+    {
+        Bump(m_globalPops);
+    }
+
+    void Stolen()
+    {
+        Bump(m_stolen);
+    }
+
+    void FailedSteal()
+    {
+        Bump(m_failedSteals);
+    }
+
+    void Spin()
+    {
+        Bump(m_spins);
+    }
+
+    void Parking()
+    {
+        m_parkStart = clock::now();
+    }
+
+    void Woken()
+    {
+        Bump(m_parks);
+        m_parked.store(m_parked.load(std::memory_order_relaxed) + (clock::now() - m_parkStart).count(),
+                       std::memory_order_relaxed);
+    }
+
+    // Runs t_task and records how long it waited and how long it ran.
+    template<typename Task>
+    void Run(Task& t_task)
+    {
+        const clock::time_point start = clock::now();
+        m_queueWait.Record(start - t_task.EnqueuedAt());
+        t_task();
+        m_execution.Record(clock::now() - start);
+        Bump(m_executed);
+    }
+
+    WorkerStatsSnapshot Snapshot() const
+    {
+        WorkerStatsSnapshot snapshot;
+        snapshot.executed = m_executed.load(std::memory_order_relaxed);
+        snapshot.localPops = m_localPops.load(std::memory_order_relaxed);
+        snapshot.globalPops = m_globalPops.load(std::memory_order_relaxed);
+        snapshot.stolen = m_stolen.load(std::memory_order_relaxed);
+        snapshot.failedSteals = m_failedSteals.load(std::memory_order_relaxed);
+        snapshot.spins = m_spins.load(std::memory_order_relaxed);
+        snapshot.parks = m_parks.load(std::memory_order_relaxed);
+        snapshot.parked = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::duration(m_parked.load(std::memory_order_relaxed)));
+        snapshot.queueWait = m_queueWait.Snapshot();
+        snapshot.execution = m_execution.Snapshot();
+        return snapshot;
+    }
+
+private:
+    template<typename T>
+    static void Bump(std::atomic<T>& t_counter)
+    {
+        t_counter.store(t_counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_executed{0};
+    std::atomic<uint64_t> m_localPops{0};
+    std::atomic<uint64_t> m_globalPops{0};
+    std::atomic<uint64_t> m_stolen{0};
+    std::atomic<uint64_t> m_failedSteals{0};
+    std::atomic<uint64_t> m_spins{0};
+    std::atomic<uint64_t> m_parks{0};
+    std::atomic<clock::rep> m_parked{0};
+    clock::time_point m_parkStart;
+    Histogram m_queueWait;
+    Histogram m_execution;
+};
+
+#else
+
+class WorkerStats
+{
+public:
+    void LocalPop()
+    {}
+
+    void GlobalPop()
+    {}
+
+    void Stolen()
+    {}
+
+    void FailedSteal()
+    {}
+
+    void Spin()
+    {}
+
+    void Parking()
+    {}
+
+    void Woken()
+    {}
+
+    template<typename Task>
+    void Run(Task& t_task)
+    {
+        t_task();
+    }
+
+    WorkerStatsSnapshot Snapshot() const
+    {
+        return WorkerStatsSnapshot();
+    }
+};
+
+#endif //THREAD_POOL_STATS
+
+#endif //THREAD_POOLS_WORKER_STATS_H
@@ -1,3 +1,4 @@
+import csv
 import os
 import re
 import subprocess as sp
@@ -8,7 +9,7 @@ from typing import List
 class Runner:
     def __init__(self, number_of_runs: int, bound_number: int):
         self.__PATH = "./bin/"
-        self.__programs = os.listdir(self.__PATH)
+        self.__programs = sorted(program for program in os.listdir(self.__PATH) if program.startswith("thread_pool"))
         self.__number_of_runs = number_of_runs
         self.__bound_number = bound_number
         self.__average_times: List[float] = list()
@@ -53,3 +54,25 @@ class Runner:
 
     def get_results(self):
         return self.__average_times, self.__min_times
+
+    def get_programs(self) -> List[str]:
+        return self.__programs
+
+
+class BenchmarkRunner:
+    """Runs every bin/pool_benchmark* target and collects the CSV lines they print."""
+
+    def __init__(self, arguments: List[str]):
+        self.__PATH = "./bin/"
+        self.__programs = sorted(program for program in os.listdir(self.__PATH) if program.startswith("pool_benchmark"))
+        self.__arguments = arguments
+        self.__rows: List[dict] = list()
+
+    def execute(self):
+        for program in self.__programs:
+            subprocess_entity = sp.run([self.__PATH + program] + self.__arguments, stdout=sp.PIPE, check=True)
+            lines = subprocess_entity.stdout.decode().splitlines()
+            self.__rows.extend(csv.DictReader(lines))
+
+    def get_results(self) -> List[dict]:
+        return self.__rows
@@ -6,14 +6,19 @@ import numpy as np
 
 
 class Visualizer:
-    def __init__(self, avg_time: List[int], min_time: List[int]):
+    def __init__(self, avg_time: List[int], min_time: List[int], programs: List[str]):
         self.__avg_time = avg_time
         self.__min_time = min_time
         self.__path = "./plots"
         self.__colors = ["pink", "blue"]
-        self.__names = ["basic", "on posix api", "on win api", "with local queue", "with work stealing"]
+        self.__names = [Visualizer.__label(program) for program in programs]
         self.__create_dir()
 
+    @staticmethod
+    def __label(program: str) -> str:
+        label = os.path.splitext(program)[0][len("thread_pool"):].lstrip("_").replace("_", " ")
+        return label if label else "basic"
+
     def __is_exist(self) -> bool:
         return os.path.exists(self.__path)
 
@@ -44,3 +49,36 @@ class Visualizer:
     def generate_graphics(self):
         self.__plot(True)
         self.__plot(False)
+
+
+class ScalingVisualizer:
+    """One plot per scenario of the pool benchmark: a line per pool over the thread counts."""
+
+    def __init__(self, rows: List[dict]):
+        self.__rows = rows
+        self.__path = "./plots"
+        if not os.path.exists(self.__path):
+            os.makedirs(self.__path)
+
+    def __plot(self, scenario: str):
+        rows = [row for row in self.__rows if row["scenario"] == scenario]
+        # The latency and idle scenarios post at a fixed rate, so their throughput says nothing;
+        # for idle the CPU time is the interesting part.
+        column, label = {"latency": ("p99_ns", "99th percentile latency in nanoseconds"),
+                         "idle": ("cpu_ms", "CPU time in milliseconds")}.get(scenario,
+                                                                            ("tasks_per_second", "tasks per second"))
+        fig, ax = plt.subplots()
+        for pool in sorted({row["pool"] for row in rows}):
+            points = sorted((int(row["threads"]), float(row[column])) for row in rows if row["pool"] == pool)
+            ax.plot([point[0] for point in points], [point[1] for point in points], marker="o", label=pool)
+
+        ax.set_title(scenario)
+        ax.set_xlabel("threads")
+        ax.set_ylabel(label)
+        ax.legend()
+        plt.savefig(self.__path + "/scaling_" + scenario)
+        plt.close(fig)
+
+    def generate_graphics(self):
+        for scenario in sorted({row["scenario"] for row in self.__rows}):
+            self.__plot(scenario)
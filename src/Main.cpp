@@ -1,9 +1,44 @@
 #include <vector>
+#include <string>
 #include <iostream>
+#include <functional>
 
 #include "Utils.h"
 #include "CrossType.h"
 
+#ifdef THREAD_POOLS_COROUTINES
+Task<int> MultiplyTask(int i, int j)
+{
+    co_return Multiply(i, j);
+}
+
+// Starts every product on the pool and awaits the results without holding a worker.
+Task<int> SumOfProducts(cross_type::thread_pool& threadPool, int boundNumber)
+{
+    std::vector<TaskFuture<int>> futures;
+    for (int i = 1; i <= boundNumber; ++i)
+    {
+        for (int j = 1; j <= boundNumber; ++j)
+        {
+            futures.emplace_back(Launch(threadPool, MultiplyTask(i, j)));
+        }
+    }
+
+    int sum = 0;
+    for (auto & future : futures)
+    {
+        sum += co_await std::move(future);
+    }
+    co_return sum;
+}
+#endif //THREAD_POOLS_COROUTINES
+
+// Optional second argument: how the tasks are handed to the pool.
+//   submit    - Submit() and std::future (default)
+//   async     - Async() and TaskFuture
+//   post      - Post(), results are added up by the tasks themselves
+//   batch     - SubmitBatch(), all tasks at once
+//   coroutine - one Task<int> per product, summed up by a coroutine (C++20 builds only)
 int main(int argc, char *argv[])
 {
     if (argc < 2)
@@ -14,27 +49,121 @@ int main(int argc, char *argv[])
 
     int result = 0;
     int boundNumber = std::stoi(argv[1]);
-    std::vector<std::future<int>> futures;
+    const std::string mode = argc > 2 ? argv[2] : "submit";
+    bool knownMode = mode == "submit" || mode == "async" || mode == "post" || mode == "batch";
+#ifdef THREAD_POOLS_COROUTINES
+    knownMode = knownMode || mode == "coroutine";
+#endif //THREAD_POOLS_COROUTINES
+    if (!knownMode)
+    {
+        std::cerr << "Unknown mode: " << mode << std::endl;
+        return 1;
+    }
+
     cross_type::thread_pool threadPool;
     auto startTime = getCurrentTime();
-    for (int i = 1; i <= boundNumber; ++i)
+    if (mode == "submit")
     {
-        for (int j = 1; j <= boundNumber; ++j)
+        std::vector<std::future<int>> futures;
+        for (int i = 1; i <= boundNumber; ++i)
         {
-            futures.emplace_back(
-                    threadPool.Submit([=]()
-                    {
-                        return Multiply(i, j);
-                    }));
+            for (int j = 1; j <= boundNumber; ++j)
+            {
+                futures.emplace_back(
+                        threadPool.Submit([=]()
+                        {
+                            return Multiply(i, j);
+                        }));
+            }
+        }
 
+        for (auto & future : futures)
+        {
+            result += future.get();
         }
     }
+    else if (mode == "async")
+    {
+        std::vector<TaskFuture<int>> futures;
+        for (int i = 1; i <= boundNumber; ++i)
+        {
+            for (int j = 1; j <= boundNumber; ++j)
+            {
+                futures.emplace_back(
+                        threadPool.Async([=]()
+                        {
+                            return Multiply(i, j);
+                        }));
+            }
+        }
 
-    for (auto & future : futures)
+        for (auto & future : futures)
+        {
+            result += future.Get();
+        }
+    }
+    else if (mode == "batch")
+    {
+        std::vector<std::function<int()>> tasks;
+        for (int i = 1; i <= boundNumber; ++i)
+        {
+            for (int j = 1; j <= boundNumber; ++j)
+            {
+                tasks.emplace_back([=]()
+                {
+                    return Multiply(i, j);
+                });
+            }
+        }
+
+        for (auto & future : threadPool.SubmitBatch(tasks.begin(), tasks.end()))
+        {
+            result += future.get();
+        }
+    }
+#ifdef THREAD_POOLS_COROUTINES
+    else if (mode == "coroutine")
     {
-        result += future.get();
+        result = Launch(threadPool, SumOfProducts(threadPool, boundNumber)).Get();
+    }
+#endif //THREAD_POOLS_COROUTINES
+    else
+    {
+        std::atomic_int sum(0);
+        std::atomic_int remaining(boundNumber * boundNumber);
+        std::promise<void> finished;
+        for (int i = 1; i <= boundNumber; ++i)
+        {
+            for (int j = 1; j <= boundNumber; ++j)
+            {
+                threadPool.Post([=, &sum, &remaining, &finished]()
+                {
+                    sum += Multiply(i, j);
+                    if (remaining.fetch_sub(1) == 1)
+                    {
+                        finished.set_value();
+                    }
+                });
+            }
+        }
+
+        if (boundNumber > 0)
+        {
+            finished.get_future().wait();
+        }
+        result = sum;
     }
     auto endTime = getCurrentTime();
 
     std::cout << "Total time: " << toUs(endTime - startTime) << std::endl;
+
+#ifdef THREAD_POOL_STATS
+    // On stderr, so that the output the benchmark scripts parse stays the same.
+    const WorkerStatsSnapshot total = threadPool.Stats().Total();
+    std::cerr << "Executed: " << total.executed << ", stolen: " << total.stolen
+              << ", failed steals: " << total.failedSteals << ", parks: " << total.parks << std::endl;
+    std::cerr << "Queue wait p50/p99 ns: " << total.queueWait.Percentile(50).count() << "/"
+              << total.queueWait.Percentile(99).count() << ", execution p50/p99 ns: "
+              << total.execution.Percentile(50).count() << "/" << total.execution.Percentile(99).count() << std::endl;
+#endif //THREAD_POOL_STATS
 }
@@ -0,0 +1,213 @@
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <unordered_map>
+
+#include "Utils.h"
+#include "CrossType.h"
+#include "ThreadSafeMap.h"
+#include "ReadOptimizedMap.h"
+
+// Usage: map_benchmark <operations> [read percent] [key count]
+//        map_benchmark bulk <entries>
+// Runs the same random mix of Find / InsertOrAssign / Erase on ThreadSafeMap,
+// ReadOptimizedMap and an std::unordered_map behind one mutex, split over one
+// task per core of the pool. Without a read percent it goes through 50, 90, 99
+// and 100.
+//
+// The bulk mode times BulkInsert(), ParallelForEach() and Snapshot() of a
+// ThreadSafeMap with <entries> keys on pools of 1, 2, 4, ... threads up to one
+// per core.
+template<typename Key, typename Value>
+class GlobalMutexMap
+{
+public:
+    std::optional<Value> Find(const Key& t_key) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_map.find(t_key);
+        if (it == m_map.end())
+        {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    bool InsertOrAssign(Key t_key, Value t_value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_map.insert_or_assign(std::move(t_key), std::move(t_value)).second;
+    }
+
+    bool Erase(const Key& t_key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_map.erase(t_key) != 0;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::unordered_map<Key, Value> m_map;
+};
+
+inline uint64_t NextRandom(uint64_t& t_state)
+{
+    t_state ^= t_state << 13;
+    t_state ^= t_state >> 7;
+    t_state ^= t_state << 17;
+    return t_state;
+}
+
+template<typename Map>
+long long RunMix(cross_type::thread_pool& t_pool, Map& t_map, std::size_t t_tasks, long long t_operations,
+                 unsigned t_readPercent, uint64_t t_keyCount)
+{
+    std::vector<std::future<void>> futures;
+    auto startTime = getCurrentTime();
+    for (std::size_t task = 0; task < t_tasks; ++task)
+    {
+        futures.emplace_back(t_pool.Submit([&t_map, task, t_tasks, t_operations, t_readPercent, t_keyCount]()
+        {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (task + 1);
+            for (long long i = static_cast<long long>(task); i < t_operations; i += t_tasks)
+            {
+                const uint64_t random = NextRandom(state);
+                const uint64_t key = (random >> 8) % t_keyCount;
+                const unsigned roll = static_cast<unsigned>(random % 100);
+                if (roll < t_readPercent)
+                {
+                    t_map.Find(key);
+                }
+                else if (roll % 2 == 0)
+                {
+                    t_map.InsertOrAssign(key, random);
+                }
+                else
+                {
+                    t_map.Erase(key);
+                }
+            }
+        }));
+    }
+
+    for (auto& future : futures)
+    {
+        future.get();
+    }
+    auto endTime = getCurrentTime();
+
+    return toUs(endTime - startTime);
+}
+
+int RunBulk(uint64_t t_entries)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    entries.reserve(t_entries);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (uint64_t i = 0; i < t_entries; ++i)
+    {
+        entries.emplace_back(NextRandom(state), i);
+    }
+
+    const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; ; threads = std::min(threads * 2, cores))
+    {
+        ThreadPlacement placement;
+        placement.threadCount = threads;
+        cross_type::thread_pool threadPool(placement);
+        ThreadSafeMap<uint64_t, uint64_t> map;
+
+        auto startTime = getCurrentTime();
+        map.BulkInsert(threadPool, entries.begin(), entries.end());
+        auto builtTime = getCurrentTime();
+        std::atomic<uint64_t> sum{0};
+        map.ParallelForEach(threadPool, [&sum](const uint64_t&, const uint64_t& t_value)
+        {
+            sum.fetch_add(t_value, std::memory_order_relaxed);
+        });
+        auto scannedTime = getCurrentTime();
+        const std::size_t copied = map.Snapshot(threadPool).size();
+        auto copiedTime = getCurrentTime();
+
+        std::cout << "Threads " << threads << ":" << std::endl;
+        std::cout << "BulkInsert time: " << toUs(builtTime - startTime) << std::endl;
+        std::cout << "ParallelForEach time: " << toUs(scannedTime - builtTime) << std::endl;
+        std::cout << "Snapshot time: " << toUs(copiedTime - scannedTime) << std::endl;
+        if (copied != map.Size())
+        {
+            std::cerr << "Snapshot lost entries" << std::endl;
+            return 1;
+        }
+        if (threads == cores)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Not enough arguments" << std::endl;
+        return 1;
+    }
+
+    if (std::string(argv[1]) == "bulk")
+    {
+        if (argc < 3)
+        {
+            std::cerr << "Not enough arguments" << std::endl;
+            return 1;
+        }
+        return RunBulk(std::stoull(argv[2]));
+    }
+
+    const long long operations = std::stoll(argv[1]);
+    const uint64_t keyCount = argc > 3 ? std::stoull(argv[3]) : 100000;
+    std::vector<unsigned> readPercents{50, 90, 99, 100};
+    if (argc > 2)
+    {
+        readPercents = {static_cast<unsigned>(std::stoul(argv[2]))};
+    }
+    if (keyCount == 0)
+    {
+        std::cerr << "Key count must be positive" << std::endl;
+        return 1;
+    }
+
+    const std::size_t tasks = std::max(1u, std::thread::hardware_concurrency());
+    cross_type::thread_pool threadPool;
+
+    for (unsigned readPercent : readPercents)
+    {
+        ThreadSafeMap<uint64_t, uint64_t> stripedMap;
+        ReadOptimizedMap<uint64_t, uint64_t> readOptimizedMap;
+        GlobalMutexMap<uint64_t, uint64_t> globalMutexMap;
+
+        // Half of the keys are there before the clock starts, so a pure read mix
+        // still finds something.
+        for (uint64_t key = 0; key < keyCount; key += 2)
+        {
+            stripedMap.InsertOrAssign(key, key);
+            readOptimizedMap.InsertOrAssign(key, key);
+            globalMutexMap.InsertOrAssign(key, key);
+        }
+
+        const long long striped = RunMix(threadPool, stripedMap, tasks, operations, readPercent, keyCount);
+        const long long readOptimized = RunMix(threadPool, readOptimizedMap, tasks, operations, readPercent, keyCount);
+        const long long global = RunMix(threadPool, globalMutexMap, tasks, operations, readPercent, keyCount);
+
+        std::cout << "Reads " << readPercent << "%:" << std::endl;
+        std::cout << "ThreadSafeMap time: " << striped << std::endl;
+        std::cout << "ReadOptimizedMap time: " << readOptimized << std::endl;
+        std::cout << "Global mutex map time: " << global << std::endl;
+    }
+}
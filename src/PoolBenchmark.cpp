@@ -0,0 +1,447 @@
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "CrossType.h"
+#include "CompletionLatch.h"
+
+// Usage: pool_benchmark [scenario...] [--threads 1,2,4] [--repetitions N] [--scale S] [--producers N] [--json]
+// Runs each scenario on the pool this target is built with, once for every
+// thread count, and prints one CSV line (or JSON object) per scenario and
+// thread count. Without scenarios it runs all of them; without --threads it
+// goes through 1, 2, 4, ... up to the number of CPUs. --scale multiplies the
+// amount of work, e.g. 0.01 for a quick check. cpu_ms is the CPU time the
+// whole process used during a run, so it includes the posting threads.
+//
+//   empty     - tasks that do nothing, posted from one thread: pure pool overhead
+//   fanout    - a few hundred nanoseconds of work per task, handed over with PostBatch()
+//   forkjoin  - recursive fibonacci, every task spawns its children on the pool
+//   skewed    - 99% short tasks and 1% a hundred times longer
+//   producers - --producers threads (4 by default) outside the pool post empty
+//               tasks at the same time
+//   latency   - one task at a time; percentiles of the time from Post() to start
+//   idle      - one task per millisecond from a sleeping thread; cpu_ms is what
+//               the idle workers burn, the percentiles are wake-ups from parking
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+// Written by the tasks so that their work is not optimized away.
+thread_local uint64_t workSink;
+
+inline void BusyWork(uint64_t t_iterations)
+{
+    uint64_t state = workSink | 1;
+    for (uint64_t i = 0; i < t_iterations; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+    }
+    workSink = state;
+}
+
+inline uint64_t Fibonacci(int t_n)
+{
+    return t_n < 2 ? static_cast<uint64_t>(t_n) : Fibonacci(t_n - 1) + Fibonacci(t_n - 2);
+}
+
+std::unique_ptr<cross_type::thread_pool> MakePool(std::size_t t_threads)
+{
+#if defined(DYNAMIC_THREAD_POOL)
+    ElasticPolicy policy;
+    policy.minThreads = t_threads;
+    policy.maxThreads = t_threads;
+    return std::make_unique<cross_type::thread_pool>(policy);
+#elif defined(_WIN32) && !defined(THREAD_POOL) && !defined(QUEUE_THREAD_POOL) && !defined(STEALING_THREAD_POOL)
+    (void)t_threads;
+    return std::make_unique<cross_type::thread_pool>();
+#else
+    ThreadPlacement placement;
+    placement.threadCount = t_threads;
+    return std::make_unique<cross_type::thread_pool>(placement);
+#endif //defined(DYNAMIC_THREAD_POOL)
+}
+
+struct Result
+{
+    std::size_t tasks = 0;
+    double milliseconds = 0;
+    // Only filled in by the latency and idle scenarios.
+    std::vector<int64_t> latencies;
+};
+
+Result RunEmpty(cross_type::thread_pool& t_pool, double t_scale)
+{
+    Result result;
+    result.tasks = static_cast<std::size_t>(1000000 * t_scale);
+    CompletionLatch done(result.tasks);
+    const auto start = benchmark_clock::now();
+    for (std::size_t i = 0; i < result.tasks; ++i)
+    {
+        t_pool.Post([&done]()
+        {
+            done.CountDown();
+        });
+    }
+    done.Wait();
+    result.milliseconds = std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+    return result;
+}
+
+Result RunFanout(cross_type::thread_pool& t_pool, double t_scale)
+{
+    Result result;
+    result.tasks = static_cast<std::size_t>(200000 * t_scale);
+    CompletionLatch done(result.tasks);
+    std::vector<std::function<void()>> tasks(result.tasks, [&done]()
+    {
+        BusyWork(256);
+        done.CountDown();
+    });
+    const auto start = benchmark_clock::now();
+    t_pool.PostBatch(tasks.begin(), tasks.end());
+    done.Wait();
+    result.milliseconds = std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+    return result;
+}
+
+// Each task hands fib(n - 2) to the pool and goes on with fib(n - 1) until n
+// is small enough to compute on the spot. The last task to finish opens the
+// latch.
+struct ForkJoin
+{
+    static constexpr int Cutoff = 13;
+
+    cross_type::thread_pool& pool;
+    std::atomic<uint64_t> sum{0};
+    std::atomic<std::size_t> outstanding{1};
+    std::atomic<std::size_t> spawned{1};
+    CompletionLatch done{1};
+
+    void Run(int t_n)
+    {
+        while (t_n > Cutoff)
+        {
+            outstanding.fetch_add(1, std::memory_order_relaxed);
+            spawned.fetch_add(1, std::memory_order_relaxed);
+            pool.Post([this, n = t_n - 2]()
+            {
+                Run(n);
+            });
+            --t_n;
+        }
+        sum.fetch_add(Fibonacci(t_n), std::memory_order_relaxed);
+        if (outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            done.CountDown();
+        }
+    }
+};
+
+Result RunForkJoin(cross_type::thread_pool& t_pool, double t_scale)
+{
+    const int n = std::max(ForkJoin::Cutoff + 2,
+                           30 + static_cast<int>(std::lround(std::log(t_scale) / std::log(1.618))));
+    ForkJoin forkJoin{t_pool};
+    const auto start = benchmark_clock::now();
+    t_pool.Post([&forkJoin, n]()
+    {
+        forkJoin.Run(n);
+    });
+    forkJoin.done.Wait();
+    Result result;
+    result.milliseconds = std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+    result.tasks = forkJoin.spawned.load();
+    if (forkJoin.sum.load() != Fibonacci(n))
+    {
+        std::cerr << "forkjoin: wrong result" << std::endl;
+        std::exit(1);
+    }
+    return result;
+}
+
+Result RunSkewed(cross_type::thread_pool& t_pool, double t_scale)
+{
+    Result result;
+    result.tasks = static_cast<std::size_t>(100000 * t_scale);
+    CompletionLatch done(result.tasks);
+    const auto start = benchmark_clock::now();
+    for (std::size_t i = 0; i < result.tasks; ++i)
+    {
+        const uint64_t iterations = i % 100 == 0 ? 25600 : 256;
+        t_pool.Post([&done, iterations]()
+        {
+            BusyWork(iterations);
+            done.CountDown();
+        });
+    }
+    done.Wait();
+    result.milliseconds = std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+    return result;
+}
+
+// Set by --producers.
+std::size_t producerCount = 4;
+
+// The same million tasks whatever the number of producers.
+Result RunProducers(cross_type::thread_pool& t_pool, double t_scale)
+{
+    Result result;
+    result.tasks = std::max<std::size_t>(1, static_cast<std::size_t>(1000000 * t_scale) / producerCount) * producerCount;
+    CompletionLatch done(result.tasks);
+    std::atomic<bool> go{false};
+    std::vector<std::thread> producers;
+    for (std::size_t producer = 0; producer < producerCount; ++producer)
+    {
+        producers.emplace_back([&t_pool, &done, &go, count = result.tasks / producerCount]()
+        {
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                t_pool.Post([&done]()
+                {
+                    done.CountDown();
+                });
+            }
+        });
+    }
+    const auto start = benchmark_clock::now();
+    go.store(true, std::memory_order_release);
+    done.Wait();
+    result.milliseconds = std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+    return result;
+}
+
+// The tasks are posted every 20 microseconds, so the pool is mostly idle and
+// the latency includes waking a worker up.
+Result RunLatency(cross_type::thread_pool& t_pool, double t_scale)
+{
+    Result result;
+    result.tasks = std::max<std::size_t>(1, static_cast<std::size_t>(20000 * t_scale));
+    result.latencies.resize(result.tasks);
+    CompletionLatch done(result.tasks);
+    const auto start = benchmark_clock::now();
+    auto next = start;
+    for (std::size_t i = 0; i < result.tasks; ++i)
+    {
+        next += std::chrono::microseconds(20);
+        while (benchmark_clock::now() < next)
+        {
+            std::this_thread::yield();
+        }
+        int64_t& latency = result.latencies[i];
+        t_pool.Post([&done, &latency, posted = benchmark_clock::now()]()
+        {
+            latency = std::chrono::duration_cast<std::chrono::nanoseconds>(benchmark_clock::now() - posted).count();
+            done.CountDown();
+        });
+    }
+    done.Wait();
+    result.milliseconds = std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+    return result;
+}
+
+// Unlike in RunLatency() the poster sleeps between the tasks, so nearly all of
+// the CPU time is spent by the pool, and the workers have long given up
+// spinning when the next task comes.
+Result RunIdle(cross_type::thread_pool& t_pool, double t_scale)
+{
+    Result result;
+    result.tasks = std::max<std::size_t>(1, static_cast<std::size_t>(500 * t_scale));
+    result.latencies.resize(result.tasks);
+    CompletionLatch done(result.tasks);
+    const auto start = benchmark_clock::now();
+    auto next = start;
+    for (std::size_t i = 0; i < result.tasks; ++i)
+    {
+        next += std::chrono::milliseconds(1);
+        std::this_thread::sleep_until(next);
+        int64_t& latency = result.latencies[i];
+        t_pool.Post([&done, &latency, posted = benchmark_clock::now()]()
+        {
+            latency = std::chrono::duration_cast<std::chrono::nanoseconds>(benchmark_clock::now() - posted).count();
+            done.CountDown();
+        });
+    }
+    done.Wait();
+    result.milliseconds = std::chrono::duration<double, std::milli>(benchmark_clock::now() - start).count();
+    return result;
+}
+
+typedef Result (*Scenario)(cross_type::thread_pool&, double);
+
+const std::vector<std::pair<std::string, Scenario>> scenarios{
+        {"empty",     RunEmpty},
+        {"fanout",    RunFanout},
+        {"forkjoin",  RunForkJoin},
+        {"skewed",    RunSkewed},
+        {"producers", RunProducers},
+        {"latency",   RunLatency},
+        {"idle",      RunIdle}};
+
+int64_t Percentile(std::vector<int64_t>& t_sorted, double t_percentile)
+{
+    if (t_sorted.empty())
+    {
+        return 0;
+    }
+    const std::size_t rank = static_cast<std::size_t>(t_percentile / 100.0 * static_cast<double>(t_sorted.size() - 1) + 0.5);
+    return t_sorted[rank];
+}
+
+std::vector<std::size_t> ParseThreads(const std::string& t_list)
+{
+    std::vector<std::size_t> threads;
+    std::stringstream stream(t_list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        threads.push_back(std::max<std::size_t>(1, std::stoul(item)));
+    }
+    return threads;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> selected;
+    std::vector<std::size_t> threadCounts;
+    std::size_t repetitions = 5;
+    double scale = 1.0;
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--threads" && i + 1 < argc)
+        {
+            threadCounts = ParseThreads(argv[++i]);
+        }
+        else if (argument == "--repetitions" && i + 1 < argc)
+        {
+            repetitions = std::max<std::size_t>(1, std::stoul(argv[++i]));
+        }
+        else if (argument == "--scale" && i + 1 < argc)
+        {
+            scale = std::stod(argv[++i]);
+        }
+        else if (argument == "--producers" && i + 1 < argc)
+        {
+            producerCount = std::max<std::size_t>(1, std::stoul(argv[++i]));
+        }
+        else if (argument == "--json")
+        {
+            json = true;
+        }
+        else if (std::any_of(scenarios.begin(), scenarios.end(), [&argument](const auto& t_scenario)
+        {
+            return t_scenario.first == argument;
+        }))
+        {
+            selected.push_back(argument);
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << argument << std::endl;
+            return 1;
+        }
+    }
+    if (!(scale > 0))
+    {
+        std::cerr << "Scale must be positive" << std::endl;
+        return 1;
+    }
+    if (threadCounts.empty())
+    {
+        const std::size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+        for (std::size_t threads = 1; threads < cpus; threads *= 2)
+        {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(cpus);
+    }
+
+    if (json)
+    {
+        std::cout << "[" << std::endl;
+    }
+    else
+    {
+        std::cout << "pool,scenario,threads,tasks,best_ms,median_ms,tasks_per_second,p50_ns,p99_ns,p999_ns,cpu_ms"
+                  << std::endl;
+    }
+
+    bool first = true;
+    for (const auto& scenario : scenarios)
+    {
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), scenario.first) == selected.end())
+        {
+            continue;
+        }
+        for (std::size_t threads : threadCounts)
+        {
+            std::unique_ptr<cross_type::thread_pool> pool = MakePool(threads);
+            std::vector<double> times;
+            std::vector<double> cpuTimes;
+            std::vector<int64_t> latencies;
+            std::size_t tasks = 0;
+            for (std::size_t repetition = 0; repetition < repetitions; ++repetition)
+            {
+                const std::clock_t cpuStart = std::clock();
+                Result result = scenario.second(*pool, scale);
+                cpuTimes.push_back(1000.0 * static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC);
+                tasks = result.tasks;
+                times.push_back(result.milliseconds);
+                latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+            }
+            std::sort(times.begin(), times.end());
+            std::sort(cpuTimes.begin(), cpuTimes.end());
+            std::sort(latencies.begin(), latencies.end());
+            const double median = times[times.size() / 2];
+            const double cpuMedian = cpuTimes[cpuTimes.size() / 2];
+
+            std::ostringstream line;
+            line << std::fixed << std::setprecision(3);
+            if (json)
+            {
+                line << (first ? "  " : ",\n  ") << "{\"pool\": \"" << cross_type::thread_pool_name
+                     << "\", \"scenario\": \"" << scenario.first << "\", \"threads\": " << threads
+                     << ", \"tasks\": " << tasks << ", \"best_ms\": " << times.front()
+                     << ", \"median_ms\": " << median << ", \"tasks_per_second\": " << tasks / median * 1000
+                     << ", \"p50_ns\": " << Percentile(latencies, 50) << ", \"p99_ns\": " << Percentile(latencies, 99)
+                     << ", \"p999_ns\": " << Percentile(latencies, 99.9) << ", \"cpu_ms\": " << cpuMedian << "}";
+            }
+            else
+            {
+                line << cross_type::thread_pool_name << "," << scenario.first << "," << threads << "," << tasks << ","
+                     << times.front() << "," << median << "," << tasks / median * 1000 << ","
+                     << Percentile(latencies, 50) << "," << Percentile(latencies, 99) << ","
+                     << Percentile(latencies, 99.9) << "," << cpuMedian << std::endl;
+            }
+            std::cout << line.str() << std::flush;
+            first = false;
+        }
+    }
+
+    if (json)
+    {
+        std::cout << "\n]" << std::endl;
+    }
+}